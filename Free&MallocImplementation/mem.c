@@ -11,13 +11,18 @@
 //////////////////////////////////////////////////////////
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <string.h>
+#include <math.h>
+#include <unwind.h>
+#include <sys/time.h>
 #include "mem.h"
+#include "memsnap.h"
 #include <stdbool.h>
 
 /*
@@ -64,6 +69,9 @@ typedef struct blk_hdr {
  * i.e. the block with the lowest address */
 blk_hdr *first_blk = NULL;
 
+/* Header of the end mark, set up by Mem_Init */
+static blk_hdr *end_blk = NULL;
+
 /*
  * Note: 
  *  The end of the available memory can be determined using end_mark
@@ -71,6 +79,244 @@ blk_hdr *first_blk = NULL;
  *
  */
 
+/*
+ * Zero watermark
+ * The region handed out by Mem_Init is a private mapping of /dev/zero, so
+ * every byte starts out as zero. Bytes at or above zero_mark (and below
+ * zero_end) have never been part of an allocated block nor written by the
+ * allocator itself. The only metadata ever stored up there is the footer
+ * of the last free block, which sits in the word at zero_end.
+ */
+static char *zero_mark = NULL;
+static char *zero_end = NULL;
+
+/*
+ * State of the incremental consistency check (see Mem_CheckStep)
+ * check_cursor     : next block to check, NULL when no pass is in progress
+ * check_prev_busy  : status of the block before check_cursor, -1 if unknown
+ * check_blocks     : blocks checked so far in this pass
+ */
+static blk_hdr *check_cursor = NULL;
+static int check_prev_busy = 1;
+static int check_blocks = 0;
+
+/*
+ * Moveable blocks
+ * Mem_AllocHandle hands out a handle, a pointer to a master pointer in
+ * handle_table that always holds the current payload address. Unless
+ * locked, the block behind a handle may be moved by Mem_Compact. A handle
+ * block keeps its handle_table index in the first word of its payload;
+ * the caller's data starts HANDLE_PAD bytes further on to keep it 8 byte
+ * aligned.
+ */
+#define HANDLE_SLOTS 1024
+#define HANDLE_PAD 8
+
+typedef struct handle_entry {
+    void *ptr;     /* master pointer to the caller's data, NULL if unused */
+    int locks;     /* Mem_Lock nesting count, the block is pinned while > 0 */
+} handle_entry;
+
+static handle_entry handle_table[HANDLE_SLOTS];
+
+/*
+ * Keeps an incremental check pass valid after the allocator rewrote the
+ * headers of the blocks starting at lo, up to (not including) hi
+ * If the cursor was swallowed by a merge it is moved back to lo; if it sits
+ * right after the change its previous block is no longer known
+ */
+static void check_touched(blk_hdr *lo, blk_hdr *hi) {
+    if (check_cursor == NULL || check_cursor <= lo || check_cursor > hi) {
+        return;
+    }
+    if (check_cursor < hi) {
+        check_cursor = lo;
+    }
+    check_prev_busy = -1;
+}
+
+/*
+ * Sampling heap profiler
+ * When enabled, an allocation is sampled each time the running byte count
+ * crosses the next sampling point; the distance between points is drawn
+ * from an exponential distribution with mean prof_rate, so each byte has the
+ * same chance of being sampled. A sample records the payload address, the
+ * requested size and the call stack in prof_table, an open addressed hash
+ * table keyed by the payload address (malloc cannot be used here). The keys
+ * live apart in prof_keys, so the lookup every Mem_Free makes while samples
+ * are live touches a few cache lines instead of the whole table
+ */
+#define PROF_SLOTS 4096   /* size of the sample table, a power of 2 */
+#define PROF_DEPTH 32     /* deepest call stack recorded */
+
+typedef struct prof_sample {
+    int size;                  /* requested size */
+    int depth;                 /* number of frames in stack */
+    void *stack[PROF_DEPTH];   /* return addresses, innermost first */
+} prof_sample;
+
+static void *prof_keys[PROF_SLOTS];    /* payload addresses, NULL = empty */
+static prof_sample prof_table[PROF_SLOTS];
+static int prof_rate = 0;              /* mean bytes between samples, 0 = off */
+static long prof_bytes_left = 0;       /* bytes until the next sample */
+static unsigned long long prof_rng = 0x9e3779b97f4a7c15ULL;
+static int prof_live = 0;              /* samples in prof_table */
+
+/* Returns the number of bytes until the next sample */
+static long prof_next_interval() {
+    // xorshift64* gives a uniform u in (0, 1]
+    prof_rng ^= prof_rng >> 12;
+    prof_rng ^= prof_rng << 25;
+    prof_rng ^= prof_rng >> 27;
+    double u = ((prof_rng * 2685821657736338717ULL >> 11) + 1) *
+        (1.0 / 9007199254740992.0);
+    return (long)(-log(u) * prof_rate) + 1;
+}
+
+/* Returns the home slot of a payload address in prof_table */
+static int prof_slot(void *ptr) {
+    unsigned long long h = (unsigned long)ptr >> 3;
+    return (int)((h * 0x9e3779b97f4a7c15ULL) >> 40) & (PROF_SLOTS - 1);
+}
+
+/* State passed to prof_frame while unwinding */
+typedef struct prof_walk {
+    prof_sample *sample;
+    void *site;      /* recording starts at this return address */
+    int started;
+} prof_walk;
+
+/* _Unwind_Backtrace callback, records one frame */
+static _Unwind_Reason_Code prof_frame(struct _Unwind_Context *ctx, void *arg) {
+    prof_walk *walk = arg;
+    void *ip = (void*)_Unwind_GetIP(ctx);
+
+    // skip the frames inside the allocator
+    if (!walk->started && ip != walk->site) {
+        return _URC_NO_REASON;
+    }
+    walk->started = 1;
+    walk->sample->stack[walk->sample->depth++] = ip;
+    return (walk->sample->depth == PROF_DEPTH) ? _URC_END_OF_STACK
+                                               : _URC_NO_REASON;
+}
+
+/*
+ * Claims the slot for a new sample of 'ptr' in prof_table
+ * Returns the slot, or NULL when the table is full
+ */
+static prof_sample* prof_insert(void *ptr) {
+    // keep a slot free so lookups always terminate
+    if (prof_live >= PROF_SLOTS - 1) {
+        return NULL;
+    }
+    int i = prof_slot(ptr);
+    while (prof_keys[i] != NULL) {
+        i = (i + 1) & (PROF_SLOTS - 1);
+    }
+    prof_keys[i] = ptr;
+    prof_live++;
+    return &prof_table[i];
+}
+
+/*
+ * Counts an allocation against the sampling interval and records it
+ * if it is sampled
+ * Arguments - ptr: payload returned to the caller, size: requested size,
+ *             site: return address into the caller of the public API
+ */
+static void prof_account(void *ptr, int size, void *site) {
+    prof_bytes_left -= size;
+    if (prof_bytes_left > 0) {
+        return;
+    }
+    prof_bytes_left = prof_next_interval();
+
+    prof_sample *sample = prof_insert(ptr);
+    if (sample == NULL) {
+        return;
+    }
+    prof_walk walk = { sample, site, 0 };
+
+    sample->size = size;
+    sample->depth = 0;
+    _Unwind_Backtrace(prof_frame, &walk);
+    // the unwinder never saw the call site, fall back to the site alone
+    if (sample->depth == 0) {
+        sample->stack[sample->depth++] = site;
+    }
+}
+
+/*
+ * Drops the sample for a payload that is being freed, if there is one
+ * Uses backward shift deletion so no tombstones are needed
+ */
+static void prof_forget(void *ptr) {
+    int i = prof_slot(ptr);
+
+    while (prof_keys[i] != ptr) {
+        if (prof_keys[i] == NULL) {
+            return;
+        }
+        i = (i + 1) & (PROF_SLOTS - 1);
+    }
+    prof_live--;
+
+    // pull later entries of the probe chain into the hole
+    int hole = i;
+    for (;;) {
+        i = (i + 1) & (PROF_SLOTS - 1);
+        if (prof_keys[i] == NULL) {
+            break;
+        }
+        int home = prof_slot(prof_keys[i]);
+        // entries whose home lies cyclically in (hole, i] stay put
+        if (((i - home) & (PROF_SLOTS - 1)) < ((i - hole) & (PROF_SLOTS - 1))) {
+            continue;
+        }
+        prof_keys[hole] = prof_keys[i];
+        prof_table[hole] = prof_table[i];
+        hole = i;
+    }
+    prof_keys[hole] = NULL;
+}
+
+/*
+ * Moves the sample of a payload that has been relocated from 'old_ptr'
+ * to 'new_ptr', if there is one
+ */
+static void prof_rekey(void *old_ptr, void *new_ptr) {
+    int i = prof_slot(old_ptr);
+
+    while (prof_keys[i] != old_ptr) {
+        if (prof_keys[i] == NULL) {
+            return;
+        }
+        i = (i + 1) & (PROF_SLOTS - 1);
+    }
+    prof_sample moved = prof_table[i];
+    prof_forget(old_ptr);
+    *prof_insert(new_ptr) = moved;
+}
+
+/*
+ * Common exit path for alloc_block
+ * Argument - blk: header of the block that has just been marked busy
+ * Raises the zero watermark past the block and the header that follows it
+ * Returns the payload address of blk
+ */
+static void* alloc_done(blk_hdr *blk) {
+    // block size without the status bits
+    char *blk_end = (char*)blk + (blk->size_status & ~3);
+
+    // the header of the next block lives in the first word past blk
+    if (blk_end + 4 > zero_mark) {
+        zero_mark = blk_end + 4;
+    }
+    check_touched(blk, (blk_hdr*)blk_end);
+    return (void*) (blk + 1);
+}
+
 /* 
  * Function for allocating 'size' bytes
  * Returns address of allocated block on success 
@@ -82,7 +328,7 @@ blk_hdr *first_blk = NULL;
  * - Also, when allocating a block - split it into two blocks
  * Tips: Be careful with pointer arithmetic 
  */
-void* Mem_Alloc(int size) {
+static void* alloc_block(int size) {
     // if size is bigger than what's possible and if size is less than 1
     if (size > 131070 || size < 1) {
         // return null
@@ -160,17 +406,13 @@ void* Mem_Alloc(int size) {
                     ptr->size_status++;
                     // set the nextPtr to point to the next header block
                     next_Ptr = ptr + size_Of_Block/4;
-                    // checks if nextPtr is pointing to end of heap
-                    if (next_Ptr->size_status == 1) {
-                        // set is_End_Of_Heap to true
-                        is_End_Of_Heap = true;
-                        // break out of while loop
-                        break;
+                    // the end mark carries no previous-block bit
+                    if (next_Ptr->size_status != 1) {
+                        // updates the size status of the next header_block
+                        next_Ptr->size_status += 2;
                     }
-                    // updates the size status of the next header_block
-                    next_Ptr->size_status += 2;
                     // returns the ptr to the payload to the mem block
-                    return (void*) (ptr + 1);
+                    return alloc_done(ptr);
                 // if block is big enough and smaller than previous min
                 } else if (smallest_Free_Blk == NULL || 
 			size_Of_Block < size_Of_Prev_Free) {
@@ -244,7 +486,7 @@ void* Mem_Alloc(int size) {
             // updates size status of coalesce block by 2
             coalesce_Blk->size_status += 2;
             // return pointer to the smallest free block's payload
-            return (void *) (smallest_Free_Blk + 1);
+            return alloc_done(smallest_Free_Blk);
         // if it isnt end of heap and the next block's right most bit is 1
         } else if (is_End_Of_Heap == false && next_Right_Most_Bit == 1) {
             // set the footer pointer to point to footer
@@ -256,7 +498,7 @@ void* Mem_Alloc(int size) {
             // update size status of coalesce block
             coalesce_Blk->size_status = size_Of_Split_Diff + 2;
             // return pointer to the smallest free block's payload
-            return (void *) (smallest_Free_Blk + 1);
+            return alloc_done(smallest_Free_Blk);
         // if it is the end of the heap
         } else {
             // set footer pointer of split block
@@ -269,11 +511,25 @@ void* Mem_Alloc(int size) {
             // set size staus of the next block after the free one
             next_Blk_After_Free->size_status = size_Of_Split_Diff + 2;
             // return pointer to the smallest free block
-            return (void *) (smallest_Free_Blk + 1);
+            return alloc_done(smallest_Free_Blk);
         }
     }
 }
 
+/*
+ * Function for allocating 'size' bytes, see alloc_block
+ * Returns address of allocated block on success
+ * Returns NULL on failure
+ */
+void* Mem_Alloc(int size) {
+    void *ptr = alloc_block(size);
+
+    if (ptr != NULL && prof_rate > 0) {
+        prof_account(ptr, size, __builtin_return_address(0));
+    }
+    return ptr;
+}
+
 /* 
  * Function for freeing up a previously allocated block 
  * Argument - ptr: Address of the block to be freed up 
@@ -372,10 +628,57 @@ int Mem_Free(void *ptr) {
         prev_Blk_Hdr->size_status += size_Of_Blk + size_Of_Next_Blk;
         // updates size status of footer pointer
         footer_Ptr->size_status += size_Of_Prev_Blk;
+        // the merged block now starts at the previous block
+        pointer = prev_Blk_Hdr;
+    }
+    check_touched(pointer, next_Blk_Hdr + size_Of_Next_Blk/4);
+    // the block is gone, and so is its sample
+    if (prof_live > 0) {
+        prof_forget(ptr);
     }
     return 0;
 }
 
+/*
+ * Function for allocating an array of 'nmemb' elements of 'size' bytes each
+ * with every byte set to zero
+ * Returns address of allocated block on success
+ * Returns NULL on failure
+ * Only the part of the payload that lies below the zero watermark (plus the
+ * last free block's footer, if it falls inside) is cleared; memory that has
+ * never been handed out is still zero from /dev/zero
+ */
+void* Mem_Calloc(int nmemb, int size) {
+    // reject non-positive counts and products that overflow or are too big
+    if (nmemb < 1 || size < 1 || nmemb > 131070 / size) {
+        return NULL;
+    }
+    int total = nmemb * size;
+
+    // anything below the watermark as it stands now may be dirty
+    char *dirty_end = zero_mark;
+    char *footer = zero_end;
+
+    char *ptr = alloc_block(total);
+    if (ptr == NULL) {
+        return NULL;
+    }
+    if (prof_rate > 0) {
+        prof_account(ptr, total, __builtin_return_address(0));
+    }
+    char *end = ptr + total;
+
+    // clear the recycled part of the payload
+    if (ptr < dirty_end) {
+        memset(ptr, 0, (end < dirty_end ? end : dirty_end) - ptr);
+    }
+    // the footer of the last free block may be inside the untouched part
+    if (footer >= dirty_end && footer >= ptr && footer < end) {
+        memset(footer, 0, (end - footer < 4) ? end - footer : 4);
+    }
+    return ptr;
+}
+
 /*
  * Function used to initialize the memory allocator
  * Not intended to be called more than once by a program
@@ -444,14 +747,512 @@ int Mem_Init(int sizeOfRegion) {
 
     // Setting up the end mark and marking it as busy
     end_mark->size_status = 1;
+    end_blk = end_mark;
 
     // Setting up the footer
     blk_hdr *footer = (blk_hdr*) ((char*)first_blk + alloc_size - 4);
     footer->size_status = alloc_size;
+
+    // Everything between the first header and the footer is still zero
+    zero_mark = (char*)first_blk + 4;
+    zero_end = (char*)footer;
   
     return 0;
 }
 
+/*
+ * Checks a single block during a consistency pass
+ * Arguments - blk: header of the block
+ *             prev_busy: 1/0 if the previous block is busy/free, -1 if unknown
+ * Returns MEM_CHECK_OK or the code of the first problem found
+ */
+static int check_block(blk_hdr *blk, int prev_busy) {
+    int status = blk->size_status;
+    int size = status & ~3;
+
+    // a stray end mark or a size that cannot be right
+    if (status == 1) {
+        return MEM_CHECK_END_MARK;
+    }
+    if (size < 8 || size % 8 != 0 || size > (char*)end_blk - (char*)blk) {
+        return MEM_CHECK_SIZE;
+    }
+    // the previous-busy bit has to agree with the block before
+    if (prev_busy != -1 && ((status & 2) != 0) != prev_busy) {
+        return MEM_CHECK_PREV;
+    }
+    if ((status & 1) == 0) {
+        // free blocks are always coalesced with their neighbours
+        if ((status & 2) == 0) {
+            return MEM_CHECK_ADJ_FREE;
+        }
+        // and carry a footer holding the plain size
+        if ((blk + size/4 - 1)->size_status != size) {
+            return MEM_CHECK_FOOTER;
+        }
+    }
+    return MEM_CHECK_OK;
+}
+
+/*
+ * Runs the current consistency pass over at most 'nblocks' blocks
+ * (all remaining blocks if nblocks < 1) and fills in 'result' if not NULL
+ * Returns 0 if no problem was found, -1 otherwise
+ */
+static int check_run(int nblocks, mem_check_t *result) {
+    int error = MEM_CHECK_OK;
+    int done = 0;
+
+    // nothing to check before Mem_Init
+    if (first_blk == NULL) {
+        if (result != NULL) {
+            result->error = MEM_CHECK_END_MARK;
+            result->block = NULL;
+            result->blocks = 0;
+            result->done = 1;
+        }
+        return -1;
+    }
+    if (check_cursor == NULL) {
+        check_cursor = first_blk;
+        check_prev_busy = 1;
+        check_blocks = 0;
+    }
+
+    // a non-positive count means no limit
+    int unlimited = nblocks < 1;
+
+    while (unlimited || nblocks-- > 0) {
+        // reaching the end mark completes the pass
+        if (check_cursor >= end_blk) {
+            if (check_cursor != end_blk || end_blk->size_status != 1) {
+                error = MEM_CHECK_END_MARK;
+            }
+            done = 1;
+            break;
+        }
+        error = check_block(check_cursor, check_prev_busy);
+        if (error != MEM_CHECK_OK) {
+            break;
+        }
+        check_prev_busy = check_cursor->size_status & 1;
+        check_cursor += (check_cursor->size_status & ~3)/4;
+        check_blocks++;
+    }
+
+    if (result != NULL) {
+        result->error = error;
+        result->block = (error == MEM_CHECK_OK) ? NULL : (void*)check_cursor;
+        result->blocks = check_blocks;
+        result->done = done || error != MEM_CHECK_OK;
+    }
+    // start over on the next call once this pass is over
+    if (done || error != MEM_CHECK_OK) {
+        check_cursor = NULL;
+    }
+    return (error == MEM_CHECK_OK) ? 0 : -1;
+}
+
+/*
+ * Function for checking the consistency of the whole heap in one pass
+ * Verifies, for every block, the size, the previous-busy bit, the footer
+ * of free blocks and that no two free blocks are adjacent, and that the
+ * walk ends exactly on the end mark
+ * Abandons any incremental pass in progress
+ * Argument - result: filled in with the outcome, may be NULL
+ * Returns 0 if the heap is consistent, -1 otherwise
+ */
+int Mem_Check(mem_check_t *result) {
+    check_cursor = NULL;
+    return check_run(0, result);
+}
+
+/*
+ * Incremental version of Mem_Check
+ * Each call checks at most 'nblocks' more blocks of the current pass, so it
+ * can be called periodically without stalling the program; result->done is
+ * set when the pass has reached the end mark (or found a problem) and the
+ * next call starts a new pass
+ * Mem_Alloc and Mem_Free may be called between steps
+ * Returns 0 if no problem was found so far, -1 otherwise
+ */
+int Mem_CheckStep(int nblocks, mem_check_t *result) {
+    if (nblocks < 1) {
+        nblocks = 1;
+    }
+    return check_run(nblocks, result);
+}
+
+/*
+ * Returns the handle_table entry of a handle, NULL if it is not a live handle
+ */
+static handle_entry* handle_entry_of(void **handle) {
+    handle_entry *entry = (handle_entry*)handle;
+
+    if (entry < handle_table || entry >= handle_table + HANDLE_SLOTS ||
+        (char*)entry != (char*)&handle_table[entry - handle_table] ||
+        entry->ptr == NULL) {
+        return NULL;
+    }
+    return entry;
+}
+
+/*
+ * Function for allocating a moveable block of 'size' bytes
+ * The current address of the block is *handle; it stays valid until the
+ * next call that may move memory (Mem_AllocHandle, Mem_Compact) unless the
+ * handle is locked with Mem_Lock
+ * If the heap has no room the heap is compacted and the allocation retried
+ * Returns the handle on success
+ * Returns NULL on failure
+ */
+void** Mem_AllocHandle(int size) {
+    int i;
+
+    if (size < 1 || size > 131070 - HANDLE_PAD) {
+        return NULL;
+    }
+    for (i = 0; i < HANDLE_SLOTS && handle_table[i].ptr != NULL; i++) {
+    }
+    if (i == HANDLE_SLOTS) {
+        return NULL;
+    }
+
+    int *payload = alloc_block(size + HANDLE_PAD);
+    if (payload == NULL) {
+        Mem_Compact();
+        payload = alloc_block(size + HANDLE_PAD);
+        if (payload == NULL) {
+            return NULL;
+        }
+    }
+    if (prof_rate > 0) {
+        prof_account(payload, size + HANDLE_PAD, __builtin_return_address(0));
+    }
+    *payload = i;
+    handle_table[i].ptr = (char*)payload + HANDLE_PAD;
+    handle_table[i].locks = 0;
+    return &handle_table[i].ptr;
+}
+
+/*
+ * Function for freeing a block allocated with Mem_AllocHandle
+ * The handle itself becomes invalid, even if it was locked
+ * Returns 0 on success
+ * Returns -1 if handle is not a live handle
+ */
+int Mem_FreeHandle(void **handle) {
+    handle_entry *entry = handle_entry_of(handle);
+
+    if (entry == NULL) {
+        return -1;
+    }
+    void *payload = (char*)entry->ptr - HANDLE_PAD;
+    entry->ptr = NULL;
+    entry->locks = 0;
+    return Mem_Free(payload);
+}
+
+/*
+ * Function for pinning a moveable block in place
+ * Locks nest; the block may move again once every Mem_Lock has been
+ * matched by a Mem_Unlock
+ * Returns the address of the block on success
+ * Returns NULL if handle is not a live handle
+ */
+void* Mem_Lock(void **handle) {
+    handle_entry *entry = handle_entry_of(handle);
+
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->locks++;
+    return entry->ptr;
+}
+
+/*
+ * Function for undoing one Mem_Lock
+ * Returns 0 on success
+ * Returns -1 if handle is not a live, locked handle
+ */
+int Mem_Unlock(void **handle) {
+    handle_entry *entry = handle_entry_of(handle);
+
+    if (entry == NULL || entry->locks == 0) {
+        return -1;
+    }
+    entry->locks--;
+    return 0;
+}
+
+/*
+ * Returns the handle_table entry of a busy block if the block may be
+ * moved, i.e. it belongs to an unlocked handle, NULL otherwise
+ */
+static handle_entry* handle_movable(blk_hdr *blk) {
+    int i = (blk + 1)->size_status;
+
+    // the first payload word of a plain block can hold anything, so only
+    // trust it if the entry points right back at this block
+    if (i < 0 || i >= HANDLE_SLOTS ||
+        handle_table[i].ptr != (char*)(blk + 1) + HANDLE_PAD) {
+        return NULL;
+    }
+    return (handle_table[i].locks == 0) ? &handle_table[i] : NULL;
+}
+
+/*
+ * Function for compacting the heap, meant to be called when the program
+ * is idle
+ * Every unlocked handle block that follows a free block is slid down to
+ * the start of that free block, so the free space bubbles up towards the
+ * end of the heap and merges with the free blocks it meets. Plain blocks
+ * from Mem_Alloc and locked handles stay where they are
+ * Returns the number of blocks moved
+ */
+int Mem_Compact() {
+    blk_hdr *current = first_blk;
+    int moved = 0;
+
+    if (current == NULL) {
+        return 0;
+    }
+    while (current->size_status != 1) {
+        int size = current->size_status & ~3;
+        blk_hdr *next = current + size/4;
+        handle_entry *entry = NULL;
+
+        if ((current->size_status & 1) == 0 && next->size_status != 1) {
+            entry = handle_movable(next);
+        }
+        if (entry == NULL) {
+            current = next;
+            continue;
+        }
+
+        // slide the busy block down over the free one
+        int free_size = size;
+        int busy_size = next->size_status & ~3;
+        int prev_bit = current->size_status & 2;
+        blk_hdr *after = next + busy_size/4;
+        void *old_payload = next + 1;
+
+        memmove(current, next, busy_size);
+        current->size_status = busy_size + prev_bit + 1;
+        entry->ptr = (char*)(current + 1) + HANDLE_PAD;
+        if (prof_live > 0) {
+            prof_rekey(old_payload, current + 1);
+        }
+
+        // the free space now follows it, merged with a free block after
+        blk_hdr *hole = current + busy_size/4;
+        if (after->size_status != 1 && (after->size_status & 1) == 0) {
+            free_size += after->size_status & ~3;
+        } else if (after->size_status != 1) {
+            after->size_status &= ~2;
+        }
+        hole->size_status = free_size + 2;
+        (hole + free_size/4 - 1)->size_status = free_size;
+
+        moved++;
+        current = hole;
+    }
+
+    // blocks have moved under any incremental check, start it over
+    check_cursor = NULL;
+    return moved;
+}
+
+/*
+ * Function for writing a binary snapshot of the heap layout to 'fd'
+ * The snapshot (see memsnap.h) lists runs of busy and free blocks and is
+ * put together in a scratch mapping so it goes out with a single write()
+ * Returns 0 on success
+ * Returns -1 before Mem_Init or on failure
+ */
+int Mem_Snapshot(int fd) {
+    blk_hdr *current;
+    int nruns = 0;
+    int last = -1;
+
+    if (first_blk == NULL) {
+        return -1;
+    }
+
+    // count the runs first so the buffer can be sized
+    for (current = first_blk; current->size_status != 1;
+         current += (current->size_status & ~3)/4) {
+        if ((current->size_status & 1) != last) {
+            last = current->size_status & 1;
+            nruns++;
+        }
+    }
+
+    size_t len = sizeof(memsnap_hdr) + nruns * sizeof(memsnap_run);
+    void *buf = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == buf) {
+        return -1;
+    }
+    memsnap_hdr *hdr = buf;
+    memsnap_run *run = (memsnap_run*)(hdr + 1) - 1;
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    memcpy(hdr->magic, MEMSNAP_MAGIC, sizeof(hdr->magic));
+    hdr->time_usec = (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+    hdr->region_size = (char*)end_blk - (char*)first_blk;
+    hdr->nruns = nruns;
+
+    // second pass fills in the runs
+    last = -1;
+    for (current = first_blk; current->size_status != 1;
+         current += (current->size_status & ~3)/4) {
+        int size = current->size_status & ~3;
+        int busy = current->size_status & 1;
+        if (busy != last) {
+            last = busy;
+            run++;
+            run->offset = (char*)current - (char*)first_blk;
+            run->size_busy = busy;
+        }
+        run->size_busy += size;
+    }
+
+    int ret = (write(fd, buf, len) == (ssize_t)len) ? 0 : -1;
+    munmap(buf, len);
+    return ret;
+}
+
+/*
+ * Function for starting the sampling heap profiler
+ * Argument - sample_bytes: average number of allocated bytes between samples
+ * Samples taken by an earlier run are discarded
+ * Returns 0 on success
+ * Returns -1 if sample_bytes is not positive
+ */
+int Mem_ProfileStart(int sample_bytes) {
+    if (sample_bytes < 1) {
+        return -1;
+    }
+    Mem_ProfileStop();
+    prof_rate = sample_bytes;
+    prof_bytes_left = prof_next_interval();
+    return 0;
+}
+
+/*
+ * Function for stopping the sampling heap profiler
+ * Discards all samples
+ */
+void Mem_ProfileStop() {
+    prof_rate = 0;
+    prof_live = 0;
+    memset(prof_keys, 0, sizeof(prof_keys));
+    memset(prof_table, 0, sizeof(prof_table));
+}
+
+/* Writes all of buf to fd, returns 0 on success and -1 on failure */
+static int prof_write(int fd, const char *buf, int len) {
+    while (len > 0) {
+        int n = write(fd, buf, len);
+        if (n < 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* qsort comparator ordering prof_table slots by call stack */
+static int prof_compare(const void *a, const void *b) {
+    const prof_sample *x = &prof_table[*(const int*)a];
+    const prof_sample *y = &prof_table[*(const int*)b];
+
+    if (x->depth != y->depth) {
+        return x->depth - y->depth;
+    }
+    return memcmp(x->stack, y->stack, x->depth * sizeof(void*));
+}
+
+/*
+ * Function for writing the live sampled allocations to 'fd'
+ * The output is a heap profile in the legacy text format understood by
+ * pprof: a header line, one line per distinct call stack with the number
+ * of sampled objects and bytes still allocated from it, and the memory map
+ * of the process. Counts are raw samples; pprof scales them by the rate
+ * given in the header (heap_v2/<sample_bytes>)
+ * Returns 0 on success
+ * Returns -1 if the profiler is not running or on a write error
+ */
+int Mem_ProfileDump(int fd) {
+    char buf[64 + 20 * PROF_DEPTH];
+    static int order[PROF_SLOTS];
+    int live = 0;
+    int objs = 0;
+    long bytes = 0;
+    int len;
+    int i, j, k;
+
+    if (prof_rate == 0) {
+        return -1;
+    }
+    for (i = 0; i < PROF_SLOTS; i++) {
+        if (prof_keys[i] != NULL) {
+            order[live++] = i;
+            objs++;
+            bytes += prof_table[i].size;
+        }
+    }
+    len = snprintf(buf, sizeof(buf),
+        "heap profile: %6d: %8ld [%6d: %8ld] @ heap_v2/%d\n",
+        objs, bytes, objs, bytes, prof_rate);
+    if (prof_write(fd, buf, len) != 0) {
+        return -1;
+    }
+
+    // one line per call stack; sorted, identical stacks are neighbours
+    qsort(order, live, sizeof(int), prof_compare);
+    for (i = 0; i < live; i = j) {
+        prof_sample *sample = &prof_table[order[i]];
+        objs = 0;
+        bytes = 0;
+        for (j = i; j < live &&
+             prof_compare(&order[i], &order[j]) == 0; j++) {
+            objs++;
+            bytes += prof_table[order[j]].size;
+        }
+        len = snprintf(buf, sizeof(buf), "%6d: %8ld [%6d: %8ld] @",
+                       objs, bytes, objs, bytes);
+        for (k = 0; k < sample->depth; k++) {
+            len += snprintf(buf + len, sizeof(buf) - len, " %p",
+                            sample->stack[k]);
+        }
+        buf[len++] = '\n';
+        if (prof_write(fd, buf, len) != 0) {
+            return -1;
+        }
+    }
+
+    // pprof needs the memory map to symbolize the addresses
+    len = snprintf(buf, sizeof(buf), "\nMAPPED_LIBRARIES:\n");
+    if (prof_write(fd, buf, len) != 0) {
+        return -1;
+    }
+    int maps = open("/proc/self/maps", O_RDONLY);
+    if (maps != -1) {
+        while ((len = read(maps, buf, sizeof(buf))) > 0) {
+            if (prof_write(fd, buf, len) != 0) {
+                close(maps);
+                return -1;
+            }
+        }
+        close(maps);
+    }
+    return 0;
+}
+
 /* 
  * Function to be used for debugging 
  * Prints out a list of all the blocks along with the following information i
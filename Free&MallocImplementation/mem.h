@@ -1,9 +1,39 @@
 #ifndef __mem_h__
 #define __mem_h__
 
+/* Error codes reported by Mem_Check */
+#define MEM_CHECK_OK        0  /* heap is consistent */
+#define MEM_CHECK_SIZE      1  /* block size is not a positive multiple of 8
+                                  or runs past the end mark */
+#define MEM_CHECK_PREV      2  /* previous-busy bit disagrees with the
+                                  previous block */
+#define MEM_CHECK_ADJ_FREE  3  /* two free blocks next to each other */
+#define MEM_CHECK_FOOTER    4  /* free block footer does not match its size */
+#define MEM_CHECK_END_MARK  5  /* end mark missing or out of place */
+
+/* Outcome of Mem_Check / Mem_CheckStep */
+typedef struct mem_check {
+    int error;    /* MEM_CHECK_OK or one of the codes above */
+    void *block;  /* header of the offending block, NULL if none */
+    int blocks;   /* blocks checked so far in this pass */
+    int done;     /* 1 once the pass is over */
+} mem_check_t;
+
 int Mem_Init(int sizeOfRegion);
 void* Mem_Alloc(int size);
+void* Mem_Calloc(int nmemb, int size);
 int Mem_Free(void *ptr);
+void** Mem_AllocHandle(int size);
+int Mem_FreeHandle(void **handle);
+void* Mem_Lock(void **handle);
+int Mem_Unlock(void **handle);
+int Mem_Compact();
+int Mem_Check(mem_check_t *result);
+int Mem_CheckStep(int nblocks, mem_check_t *result);
+int Mem_Snapshot(int fd);
+int Mem_ProfileStart(int sample_bytes);
+void Mem_ProfileStop();
+int Mem_ProfileDump(int fd);
 void Mem_Dump();
 
 void* malloc(size_t size) {
@@ -0,0 +1,216 @@
+//////////////////////////////////////////////////////////
+//
+// File Name: memsnap.c
+//
+// Description: Offline viewer for heap snapshots written by
+// Mem_Snapshot. Prints a fragmentation map and a histogram of
+// free block sizes for each snapshot and, given several
+// snapshots, a time series of how the heap evolved.
+//
+//////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "memsnap.h"
+
+/* Number of power of 2 buckets in the free size histogram */
+#define HIST_BUCKETS 32
+
+/* Summary of one snapshot, one row of the time series */
+typedef struct snap_stats {
+    const char *name;
+    uint64_t time_usec;
+    uint32_t busy;          /* bytes in busy blocks */
+    uint32_t free;          /* bytes in free blocks */
+    uint32_t free_blocks;   /* number of free blocks */
+    uint32_t largest_free;  /* size of the largest free block */
+} snap_stats;
+
+/*
+ * Reads a snapshot file
+ * Arguments - fn: file name, hdr: filled in with the header
+ * Returns the runs (to be freed by the caller) or NULL on failure
+ */
+memsnap_run* readSnapshot(const char *fn, memsnap_hdr *hdr) {
+    FILE *fp = fopen(fn, "rb");
+    memsnap_run *runs = NULL;
+
+    if (fp == NULL) {
+        perror(fn);
+        return NULL;
+    }
+    if (fread(hdr, sizeof(*hdr), 1, fp) != 1 ||
+        memcmp(hdr->magic, MEMSNAP_MAGIC, sizeof(hdr->magic)) != 0) {
+        fprintf(stderr, "%s: not a heap snapshot\n", fn);
+        fclose(fp);
+        return NULL;
+    }
+    // one extra record so an empty snapshot still gets a buffer
+    runs = malloc((hdr->nruns + 1) * sizeof(memsnap_run));
+    if (runs == NULL ||
+        fread(runs, sizeof(memsnap_run), hdr->nruns, fp) != hdr->nruns) {
+        fprintf(stderr, "%s: truncated snapshot\n", fn);
+        free(runs);
+        runs = NULL;
+    }
+    fclose(fp);
+    return runs;
+}
+
+/*
+ * Prints the fragmentation map, one character per region/width bytes
+ * ' ' = all free, '#' = all busy, '.' ':' '+' = less than 1/4, 1/2, 3/4 busy
+ */
+void printMap(const memsnap_hdr *hdr, const memsnap_run *runs, int width) {
+    const char shades[] = ".:+";
+    double cell = (double)hdr->region_size / width;
+    uint32_t r = 0;
+
+    for (int i = 0; i < width; i++) {
+        double lo = i * cell;
+        double hi = lo + cell;
+        double busy = 0;
+
+        // skip runs that end before this cell
+        while (r < hdr->nruns &&
+               runs[r].offset + (runs[r].size_busy & ~1u) <= lo) {
+            r++;
+        }
+        // add up the busy bytes of the runs overlapping the cell
+        for (uint32_t k = r; k < hdr->nruns && runs[k].offset < hi; k++) {
+            double start = runs[k].offset;
+            double end = start + (runs[k].size_busy & ~1u);
+            if (runs[k].size_busy & 1) {
+                busy += (end < hi ? end : hi) - (start > lo ? start : lo);
+            }
+        }
+
+        if (busy <= 0) {
+            putchar(' ');
+        } else if (busy >= cell) {
+            putchar('#');
+        } else {
+            putchar(shades[(int)(busy / cell * 3)]);
+        }
+        if ((i + 1) % 64 == 0 || i + 1 == width) {
+            putchar('|');
+            putchar('\n');
+        }
+    }
+}
+
+/*
+ * Prints one snapshot and fills in its summary
+ */
+void printSnapshot(const memsnap_hdr *hdr, const memsnap_run *runs,
+                   int width, snap_stats *st) {
+    uint32_t count[HIST_BUCKETS] = {0};
+    uint64_t bytes[HIST_BUCKETS] = {0};
+
+    st->time_usec = hdr->time_usec;
+    st->busy = st->free = st->free_blocks = st->largest_free = 0;
+    for (uint32_t i = 0; i < hdr->nruns; i++) {
+        uint32_t size = runs[i].size_busy & ~1u;
+        if (runs[i].size_busy & 1) {
+            st->busy += size;
+            continue;
+        }
+        // bucket k holds sizes in [2^k, 2^(k+1))
+        int k = 31 - __builtin_clz(size);
+        count[k]++;
+        bytes[k] += size;
+        st->free += size;
+        st->free_blocks++;
+        if (size > st->largest_free) {
+            st->largest_free = size;
+        }
+    }
+
+    printf("=== %s: %u bytes, %u runs\n", st->name, hdr->region_size,
+           hdr->nruns);
+    printMap(hdr, runs, width);
+    printf("busy %u  free %u in %u blocks  largest free %u\n", st->busy,
+           st->free, st->free_blocks, st->largest_free);
+    printf("%12s %12s %8s %12s\n", "free size >=", "<", "blocks", "bytes");
+    for (int k = 0; k < HIST_BUCKETS; k++) {
+        if (count[k] != 0) {
+            printf("%12llu %12llu %8u %12llu\n", 1ULL << k, 1ULL << (k + 1),
+                   count[k], (unsigned long long)bytes[k]);
+        }
+    }
+    printf("\n");
+}
+
+/*
+ * Prints one row per snapshot; fragmentation is 1 - largest free / free,
+ * i.e. the share of free memory that the largest request cannot use
+ */
+void printTimeSeries(const snap_stats *st, int n) {
+    printf("%-24s %10s %10s %10s %8s %10s %6s\n", "snapshot", "t (s)",
+           "busy", "free", "blocks", "largest", "frag");
+    for (int i = 0; i < n; i++) {
+        double frag = st[i].free ?
+            1.0 - (double)st[i].largest_free / st[i].free : 0.0;
+        printf("%-24s %10.3f %10u %10u %8u %10u %6.3f\n", st[i].name,
+               (st[i].time_usec - st[0].time_usec) / 1e6, st[i].busy,
+               st[i].free, st[i].free_blocks, st[i].largest_free, frag);
+    }
+}
+
+/*
+ * printUsage - Print usage info
+ */
+void printUsage(char *argv[]) {
+    printf("Usage: %s [-h] [-w <num>] <snapshot>...\n", argv[0]);
+    printf("Options:\n");
+    printf("  -h         Print this help message.\n");
+    printf("  -w <num>   Width of the fragmentation map (default 64).\n");
+    printf("\nSnapshots given in time order also get a time series.\n");
+}
+
+int main(int argc, char *argv[]) {
+    int width = 64;
+    int c;
+
+    while ((c = getopt(argc, argv, "w:h")) != -1) {
+        switch (c) {
+            case 'w':
+                width = atoi(optarg);
+                break;
+            case 'h':
+                printUsage(argv);
+                exit(0);
+            default:
+                printUsage(argv);
+                exit(1);
+        }
+    }
+    if (optind == argc || width < 1) {
+        printUsage(argv);
+        exit(1);
+    }
+
+    int n = argc - optind;
+    snap_stats *st = calloc(n, sizeof(snap_stats));
+    if (st == NULL) {
+        fprintf(stderr, "ERROR: could not allocate memory to the heap\n");
+        exit(1);
+    }
+    for (int i = 0; i < n; i++) {
+        memsnap_hdr hdr;
+        memsnap_run *runs = readSnapshot(argv[optind + i], &hdr);
+        if (runs == NULL) {
+            exit(1);
+        }
+        st[i].name = argv[optind + i];
+        printSnapshot(&hdr, runs, width, &st[i]);
+        free(runs);
+    }
+    if (n > 1) {
+        printTimeSeries(st, n);
+    }
+    free(st);
+    return 0;
+}
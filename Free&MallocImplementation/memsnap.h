@@ -0,0 +1,29 @@
+#ifndef __memsnap_h__
+#define __memsnap_h__
+
+#include <stdint.h>
+
+/*
+ * Binary heap snapshot written by Mem_Snapshot and read by memsnap
+ *
+ * A snapshot is a memsnap_hdr followed by 'nruns' memsnap_run records in
+ * address order. A run is a maximal stretch of consecutive blocks with the
+ * same status, so busy blocks next to each other share one record (free
+ * blocks are coalesced anyway). All fields are in host byte order.
+ */
+
+#define MEMSNAP_MAGIC "MEMSNAP1"
+
+typedef struct memsnap_hdr {
+    char magic[8];          /* MEMSNAP_MAGIC, not NUL terminated */
+    uint64_t time_usec;     /* wall clock time of the snapshot */
+    uint32_t region_size;   /* bytes from the first block to the end mark */
+    uint32_t nruns;         /* number of records that follow */
+} memsnap_hdr;
+
+typedef struct memsnap_run {
+    uint32_t offset;        /* start of the run, from the first block */
+    uint32_t size_busy;     /* size of the run, LSB = 1 if busy */
+} memsnap_run;
+
+#endif // __memsnap_h__
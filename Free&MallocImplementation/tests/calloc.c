@@ -0,0 +1,37 @@
+/* calloc returns zeroed memory, both fresh and recycled */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mem.h"
+
+int main() {
+    assert(Mem_Init(4096) == 0);
+    char *ptr[4];
+    int i, j;
+
+    // dirty a few chunks and give them back
+    for (i = 0; i < 4; i++) {
+        ptr[i] = Mem_Alloc(500);
+        assert(ptr[i] != NULL);
+        memset(ptr[i], 0xff, 500);
+    }
+    assert(Mem_Free(ptr[1]) == 0);
+    assert(Mem_Free(ptr[2]) == 0);
+
+    // recycled space
+    ptr[1] = Mem_Calloc(100, 8);
+    assert(ptr[1] != NULL);
+    for (j = 0; j < 800; j++)
+        assert(ptr[1][j] == 0);
+
+    // fresh space, including the last free block's footer
+    ptr[2] = Mem_Calloc(1, 4096 - 4 * 504 - 8 - 4);
+    assert(ptr[2] != NULL);
+    for (j = 0; j < 4096 - 4 * 504 - 8 - 4; j++)
+        assert(ptr[2][j] == 0);
+
+    // overflow and bad arguments
+    assert(Mem_Calloc(0, 8) == NULL);
+    assert(Mem_Calloc(65536, 65536) == NULL);
+    exit(0);
+}
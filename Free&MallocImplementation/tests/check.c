@@ -0,0 +1,54 @@
+/* heap consistency check, full and incremental */
+#include <assert.h>
+#include <stdlib.h>
+#include "mem.h"
+
+int main() {
+    assert(Mem_Init(4096) == 0);
+    mem_check_t res;
+    void *ptr[8];
+    int i;
+
+    assert(Mem_Check(&res) == 0);
+    assert(res.error == MEM_CHECK_OK && res.done == 1 && res.blocks == 1);
+
+    for (i = 0; i < 8; i++) {
+        ptr[i] = Mem_Alloc(100 + i * 12);
+        assert(ptr[i] != NULL);
+    }
+    assert(Mem_Free(ptr[2]) == 0);
+    assert(Mem_Free(ptr[5]) == 0);
+    assert(Mem_Check(&res) == 0);
+    assert(res.blocks == 9);
+
+    // incremental pass with the heap changing underneath
+    assert(Mem_CheckStep(3, &res) == 0);
+    assert(res.done == 0 && res.blocks == 3);
+    assert(Mem_Free(ptr[3]) == 0);
+    assert(Mem_Free(ptr[4]) == 0);
+    ptr[3] = Mem_Alloc(40);
+    assert(ptr[3] != NULL);
+    do {
+        assert(Mem_CheckStep(2, &res) == 0);
+    } while (!res.done);
+
+    // a broken footer is reported with its block
+    int *hdr = (int*)ptr[3] - 1;
+    hdr += (*hdr & ~3) / 4;
+    assert((*hdr & 1) == 0);
+    int *footer = hdr + (*hdr & ~3) / 4 - 1;
+    *footer += 8;
+    assert(Mem_Check(&res) == -1);
+    assert(res.error == MEM_CHECK_FOOTER && res.block == hdr);
+    *footer -= 8;
+
+    // so is a block whose previous-busy bit lies
+    hdr = (int*)ptr[7] - 1;
+    *hdr ^= 2;
+    assert(Mem_Check(&res) == -1);
+    assert(res.error == MEM_CHECK_PREV && res.block == hdr);
+    *hdr ^= 2;
+    assert(Mem_Check(NULL) == 0);
+
+    exit(0);
+}
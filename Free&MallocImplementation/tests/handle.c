@@ -0,0 +1,51 @@
+/* moveable handles are compacted around plain and locked blocks */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mem.h"
+
+int main() {
+    assert(Mem_Init(4096) == 0);
+    void **h[7];
+    char *pinned;
+    int i, j;
+
+    // 7 handles of ~500 bytes, each filled with its own index
+    for (i = 0; i < 7; i++) {
+        h[i] = Mem_AllocHandle(492);
+        assert(h[i] != NULL);
+        memset(*h[i], i, 492);
+    }
+    void *plain = Mem_Alloc(100);
+    assert(plain != NULL);
+    while (Mem_Alloc(500) != NULL)
+        ;
+
+    // punch holes; none of them is big enough on its own
+    assert(Mem_FreeHandle(h[1]) == 0);
+    assert(Mem_FreeHandle(h[3]) == 0);
+    assert(Mem_FreeHandle(h[5]) == 0);
+    assert(Mem_FreeHandle(h[5]) == -1);
+    assert(Mem_Alloc(1000) == NULL);
+
+    // h[4] is pinned and must not move
+    pinned = Mem_Lock(h[4]);
+    assert(pinned == *h[4]);
+
+    // h[2] slides over h[1]'s hole, h[6] over h[5]'s
+    assert(Mem_Compact() == 2);
+    assert(Mem_Check(NULL) == 0);
+    assert(*h[4] == pinned);
+    for (i = 0; i < 7; i += 2)
+        for (j = 0; j < 492; j++)
+            assert(((char*)*h[i])[j] == i);
+
+    // h[2]'s and h[3]'s old space is now one block
+    assert(Mem_Alloc(1000) != NULL);
+    assert(Mem_Check(NULL) == 0);
+
+    assert(Mem_Unlock(h[4]) == 0);
+    assert(Mem_Unlock(h[4]) == -1);
+    assert(Mem_Lock((void**)plain) == NULL);
+    exit(0);
+}
@@ -0,0 +1,55 @@
+/* sampling heap profiler keeps live samples and dumps them for pprof */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mem.h"
+
+static char out[65536];
+
+// a second call site, so the dump has two stacks to group
+__attribute__((noinline)) static void* alloc_elsewhere(int size) {
+    void *ptr = Mem_Alloc(size);
+    __asm__ volatile("" ::: "memory");
+    return ptr;
+}
+
+int main() {
+    assert(Mem_Init(4096) == 0);
+    int fds[2];
+    void *ptr[4];
+    void *other;
+    int i, len = 0, n;
+
+    assert(Mem_ProfileDump(1) == -1);
+    assert(Mem_ProfileStart(0) == -1);
+
+    // a one byte rate samples every allocation
+    assert(Mem_ProfileStart(1) == 0);
+    for (i = 0; i < 4; i++) {
+        ptr[i] = Mem_Alloc(64);
+        assert(ptr[i] != NULL);
+    }
+    other = alloc_elsewhere(32);
+    assert(other != NULL);
+    assert(Mem_Free(ptr[1]) == 0);
+    assert(Mem_Free(ptr[2]) == 0);
+
+    assert(pipe(fds) == 0);
+    assert(Mem_ProfileDump(fds[1]) == 0);
+    close(fds[1]);
+    while ((n = read(fds[0], out + len, sizeof(out) - 1 - len)) > 0)
+        len += n;
+    out[len] = '\0';
+
+    // two live samples of 64 bytes from one call site, 32 from another
+    assert(strncmp(out, "heap profile:      3:      160 [", 32) == 0);
+    assert(strstr(out, "@ heap_v2/1\n") != NULL);
+    assert(strstr(out, "\n     2:      128 [     2:      128] @ 0x") != NULL);
+    assert(strstr(out, "\n     1:       32 [     1:       32] @ 0x") != NULL);
+    assert(strstr(out, "\nMAPPED_LIBRARIES:\n") != NULL);
+
+    Mem_ProfileStop();
+    assert(Mem_ProfileDump(1) == -1);
+    exit(0);
+}
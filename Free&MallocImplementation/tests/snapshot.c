@@ -0,0 +1,40 @@
+/* binary heap snapshot lists busy and free runs in address order */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mem.h"
+#include "memsnap.h"
+
+int main() {
+    assert(Mem_Init(4096) == 0);
+    struct {
+        memsnap_hdr hdr;
+        memsnap_run run[8];
+    } snap;
+    void *ptr[4];
+    int fds[2];
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        ptr[i] = Mem_Alloc(60);
+        assert(ptr[i] != NULL);
+    }
+    assert(Mem_Free(ptr[1]) == 0);
+
+    assert(pipe(fds) == 0);
+    assert(Mem_Snapshot(fds[1]) == 0);
+    close(fds[1]);
+    assert(read(fds[0], &snap, sizeof(snap)) ==
+           sizeof(memsnap_hdr) + 4 * sizeof(memsnap_run));
+
+    // busy, free, two busy blocks as one run, then the rest
+    assert(memcmp(snap.hdr.magic, MEMSNAP_MAGIC, 8) == 0);
+    assert(snap.hdr.region_size == 4088);
+    assert(snap.hdr.nruns == 4);
+    assert(snap.run[0].offset == 0 && snap.run[0].size_busy == (64 | 1));
+    assert(snap.run[1].offset == 64 && snap.run[1].size_busy == 64);
+    assert(snap.run[2].offset == 128 && snap.run[2].size_busy == (128 | 1));
+    assert(snap.run[3].offset == 256 && snap.run[3].size_busy == 4088 - 256);
+    exit(0);
+}
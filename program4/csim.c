@@ -27,6 +27,14 @@
 #include <limits.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sched.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 /****************************************************************************/
 /***** DO NOT MODIFY THESE VARIABLE NAMES ***********************************/
@@ -43,9 +51,9 @@ int B; /* block size (bytes) B = 2^b */
 int S; /* number of sets S = 2^s In C, you can use the left shift operator */
 
 /* Counters used to record cache statistics */
-int hit_cnt = 0;
-int miss_cnt = 0;
-int evict_cnt = 0;
+unsigned long long hit_cnt = 0;
+unsigned long long miss_cnt = 0;
+unsigned long long evict_cnt = 0;
 /*****************************************************************************/
 
 
@@ -54,243 +62,3385 @@ int evict_cnt = 0;
  */
 typedef unsigned long long int mem_addr_t;
 
-/* Type: Cache line
- * TODO 
- * 
- * NOTE: 
- * You might (not necessarily though) want to add an extra field to this struct
- * depending on your implementation
- * 
- * For example, to use a linked list based LRU,
- * you might want to have a field "struct cache_line * next" in the struct 
+/* Type: Counter
+ * Use this type for anything counting accesses; 64 bits, so traces of
+ * more than 2^31 accesses do not wrap around
  */
-typedef struct cache_line {                     
-    char valid;
-    mem_addr_t tag;
-    struct cache_line * next;
-    int counter;
-} cache_line_t;
+typedef unsigned long long int count_t;
 
-typedef cache_line_t* cache_set_t;
-typedef cache_set_t* cache_t;
+/* Type: Cache
+ * All state lives in one contiguous allocation, laid out as arrays
+ * (structure of arrays) so a lookup only touches the tags of one set:
+ *  tags  - S*E tags, set after set; LINE_VALID is set on valid lines,
+ *          invalid lines hold 0
+ *  meta  - S*E times policy->meta words of replacement state per line,
+ *          for policies that need them, else NULL
+ *  aux   - S words of replacement state per set, along with meta
+ *  next  - S*E recency links, the next less recently used way
+ *  prev  - S*E recency links, the next more recently used way
+ *  mru   - S, the most recently used way of each set
+ *  index - S*(index_mask+1) slots of a per-set hash table from tag to way,
+ *          NO_WAY when empty; only for sets too big to scan (scan_max_e)
+ *  flags - S*E LINE_DIRTY / LINE_PREFETCHED bits: written to under
+ *          write-back (-w), brought in by a prefetch and not used yet (-f)
+ * The ways of a set form a circular list through next/prev, so the least
+ * recently used way is prev[mru]. Lines that have never been filled sit at
+ * the LRU end, so under LRU that is always the line to replace. Other
+ * replacement policies are plugged in through policy (see policy_t).
+ */
+typedef unsigned short way_t;
+
+typedef struct policy policy_t;
+
+typedef struct cache {
+    int s;                  /* set index bits */
+    int E;                  /* associativity */
+    int b;                  /* block offset bits */
+    mem_addr_t set_mask;    /* 2^s - 1 */
+    mem_addr_t* tags;
+    way_t* next;
+    way_t* prev;
+    way_t* mru;
+    way_t* index;
+    unsigned int index_mask;
+    const policy_t* policy;
+    unsigned int* meta;
+    unsigned int* aux;
+    unsigned char* flags;
+} cache_t;
+
+/* Type: Block thrown out by a fill, see fillLine */
+typedef struct victim {
+    mem_addr_t addr;        /* address of the evicted block */
+    unsigned char flags;    /* its flags before the eviction */
+} victim_t;
+
+/* Type: Replacement policy, see the replacement policies below */
+struct policy {
+    const char* name;
+    int meta;               /* words of meta per line, 0 for no meta/aux */
+    void (*init)(cache_t* c);
+    void (*hit)(cache_t* c, size_t set, int way);
+    int (*victim)(cache_t* c, size_t set);
+    void (*fill)(cache_t* c, size_t set, int way);
+    void (*invalidate)(cache_t* c, size_t set, int way);
+};
+
+/* Valid bit, packed into the tag (tags are at most 63 bits since b > 0) */
+#define LINE_VALID (1ULL << 63)
+
+/* Bits of cache_t.flags */
+#define LINE_DIRTY      1
+#define LINE_PREFETCHED 2
+#define LINE_EXCLUSIVE  4   /* MESI Exclusive, in coherence mode */
+
+/* Empty slot in a tag index; also bounds the associativity */
+#define NO_WAY 0xffff
+
+/* Largest associativity for which a set is searched by scanning its tags;
+ * bigger sets look tags up in the per-set hash table instead. A vector
+ * scan compares several tags per instruction, so it stays ahead of the
+ * hash table for bigger sets than a scalar one
+ */
+#define SCAN_MAX_E 8
+#define SCAN_MAX_E_SIMD 16
+
+/* Type: Tag scanner
+ * Returns the way among the ways tags that equals want, -1 if there is none
+ */
+typedef int (*scan_fn_t)(const mem_addr_t* tags, int ways, mem_addr_t want);
+
+
+/* The cache we are simulating */
+cache_t cache;  
+
+/*
+ * scanScalar - compares one tag at a time
+ */
+static int scanScalar(const mem_addr_t* tags, int ways, mem_addr_t want) {
+    for (int way = 0; way < ways; way++) {
+        if (tags[way] == want) {
+            return way;
+        }
+    }
+    return -1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * scanSSE4 - compares 2 tags per instruction (SSE4.1 pcmpeqq)
+ */
+__attribute__((target("sse4.1")))
+static int scanSSE4(const mem_addr_t* tags, int ways, mem_addr_t want) {
+    __m128i key = _mm_set1_epi64x(want);
+    int way = 0;
+
+    for (; way + 4 <= ways; way += 4) {
+        __m128i lo = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)(tags + way)), key);
+        __m128i hi = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)(tags + way + 2)), key);
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(lo)) |
+                   (_mm_movemask_pd(_mm_castsi128_pd(hi)) << 2);
+        if (mask != 0) {
+            return way + __builtin_ctz(mask);
+        }
+    }
+    for (; way < ways; way++) {
+        if (tags[way] == want) {
+            return way;
+        }
+    }
+    return -1;
+}
+
+/*
+ * scanAVX2 - compares 4 tags per instruction, 8 per iteration
+ */
+__attribute__((target("avx2")))
+static int scanAVX2(const mem_addr_t* tags, int ways, mem_addr_t want) {
+    __m256i key = _mm256_set1_epi64x(want);
+    int way = 0;
+
+    for (; way + 8 <= ways; way += 8) {
+        __m256i lo = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(tags + way)), key);
+        __m256i hi = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(tags + way + 4)), key);
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(lo)) |
+                   (_mm256_movemask_pd(_mm256_castsi256_pd(hi)) << 4);
+        if (mask != 0) {
+            return way + __builtin_ctz(mask);
+        }
+    }
+    for (; way + 4 <= ways; way += 4) {
+        __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(tags + way)), key);
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+        if (mask != 0) {
+            return way + __builtin_ctz(mask);
+        }
+    }
+    for (; way < ways; way++) {
+        if (tags[way] == want) {
+            return way;
+        }
+    }
+    return -1;
+}
+#endif
+
+/* Tag scanner in use and the largest set it handles, see chooseScanner */
+static scan_fn_t scanWays = scanScalar;
+static int scan_max_e = SCAN_MAX_E;
+
+/*
+ * chooseScanner - picks the tag scanner: the one named by isa ("scalar",
+ * "sse4" or "avx2") or, if isa is NULL, the best one the CPU supports
+ * Returns 0 on success, -1 if the named scanner is unknown or unsupported
+ */
+int chooseScanner(const char* isa) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    int avx2 = __builtin_cpu_supports("avx2");
+    int sse4 = __builtin_cpu_supports("sse4.1");
+
+    if ((isa == NULL && avx2) || (isa != NULL && strcmp(isa, "avx2") == 0)) {
+        if (!avx2) {
+            return -1;
+        }
+        scanWays = scanAVX2;
+        scan_max_e = SCAN_MAX_E_SIMD;
+        return 0;
+    }
+    if ((isa == NULL && sse4) || (isa != NULL && strcmp(isa, "sse4") == 0)) {
+        if (!sse4) {
+            return -1;
+        }
+        scanWays = scanSSE4;
+        scan_max_e = SCAN_MAX_E_SIMD;
+        return 0;
+    }
+#endif
+    if (isa != NULL && strcmp(isa, "scalar") != 0) {
+        return -1;
+    }
+    scanWays = scanScalar;
+    scan_max_e = SCAN_MAX_E;
+    return 0;
+}
+
+/*
+ * cacheInit - allocates and clears a cache of 2^s sets of E lines with
+ * 2^b byte blocks
+ */
+void cacheInit(cache_t* c, int s, int E, int b, const policy_t* policy) {
+    size_t sets = (size_t)1 << s;
+    size_t lines = sets * E;
+    size_t meta_words = policy->meta ? policy->meta * lines + sets : 0;
+
+    c->s = s;
+    c->E = E;
+    c->b = b;
+    c->set_mask = sets - 1;
+    c->policy = policy;
+
+    // hash table size: smallest power of 2 that is at least 2E
+    unsigned int slots = 1;
+    while (slots < 2 * (unsigned int)E) {
+        slots <<= 1;
+    }
+    size_t index_slots = (E > scan_max_e) ? sets * slots : 0;
+
+    // one allocation, tags first to keep them 8 byte aligned
+    char* mem = malloc(lines * sizeof(mem_addr_t) +
+                       meta_words * sizeof(unsigned int) +
+                       (2 * lines + sets + index_slots) * sizeof(way_t) +
+                       lines);
+    // checks if malloc worked properly
+    if (mem == NULL) {
+        fprintf(stderr, "ERROR: could not allocate memory to the heap\n");
+        exit(1);
+    }
+    c->tags = (mem_addr_t*)mem;
+    c->meta = meta_words ? (unsigned int*)(c->tags + lines) : NULL;
+    c->aux = meta_words ? c->meta + policy->meta * lines : NULL;
+    c->next = (way_t*)((unsigned int*)(c->tags + lines) + meta_words);
+    c->prev = c->next + lines;
+    c->mru = c->prev + lines;
+    c->index = index_slots ? c->mru + sets : NULL;
+    c->index_mask = slots - 1;
+    c->flags = (unsigned char*)(c->mru + sets + index_slots);
+    memset(c->flags, 0, lines);
+
+    // traverses through the sets
+    for (size_t set = 0; set < sets; set++) {
+        size_t first = set * E;
+        // traverses through the lines, chaining them in a ring
+        for (int way = 0; way < E; way++) {
+            // sets valid and tag to be 0
+            c->tags[first + way] = 0;
+            c->next[first + way] = (way + 1) % E;
+            c->prev[first + way] = (way + E - 1) % E;
+        }
+        c->mru[set] = 0;
+    }
+    // every tag index starts out empty
+    for (size_t i = 0; i < index_slots; i++) {
+        c->index[i] = NO_WAY;
+    }
+    if (meta_words) {
+        policy->init(c);
+    }
+}
+
+/*
+ * cacheFree - releases what cacheInit allocated
+ */
+void cacheFree(cache_t* c) {
+    // the tags start the single allocation
+    free(c->tags);
+    c->tags = NULL;
+}
+
+/*
+ * indexSlot - home slot of a tag in a set's tag index
+ */
+static inline unsigned int indexSlot(const cache_t* c, mem_addr_t tag) {
+    return (unsigned int)((tag * 0x9e3779b97f4a7c15ULL) >> 32) &
+        c->index_mask;
+}
+
+/*
+ * findWay - returns the way of the set holding tag, -1 on a miss
+ */
+static inline int findWay(const cache_t* c, size_t set, mem_addr_t tag) {
+    const mem_addr_t* tags = c->tags + set * c->E;
+    mem_addr_t want = tag | LINE_VALID;
+
+    // small sets are cheaper to scan
+    if (c->index == NULL) {
+        return scanWays(tags, c->E, want);
+    }
+
+    // probe until the tag or an empty slot turns up
+    const way_t* index = c->index + set * (c->index_mask + 1);
+    for (unsigned int i = indexSlot(c, tag); index[i] != NO_WAY;
+         i = (i + 1) & c->index_mask) {
+        if (tags[index[i]] == want) {
+            return index[i];
+        }
+    }
+    return -1;
+}
+
+/*
+ * indexAdd - records a newly filled way in the set's tag index
+ */
+static inline void indexAdd(cache_t* c, size_t set, int way, mem_addr_t tag) {
+    way_t* index = c->index + set * (c->index_mask + 1);
+    unsigned int i = indexSlot(c, tag);
+
+    while (index[i] != NO_WAY) {
+        i = (i + 1) & c->index_mask;
+    }
+    index[i] = way;
+}
+
+/*
+ * indexRemove - drops an evicted way from the set's tag index, shifting
+ * later entries of the probe chain back so no tombstones are needed
+ */
+static inline void indexRemove(cache_t* c, size_t set, int way,
+                               mem_addr_t tag) {
+    const mem_addr_t* tags = c->tags + set * c->E;
+    way_t* index = c->index + set * (c->index_mask + 1);
+    unsigned int mask = c->index_mask;
+    unsigned int hole = indexSlot(c, tag);
+
+    while (index[hole] != way) {
+        hole = (hole + 1) & mask;
+    }
+    for (unsigned int i = (hole + 1) & mask; index[i] != NO_WAY;
+         i = (i + 1) & mask) {
+        unsigned int home = indexSlot(c, tags[index[i]] & ~LINE_VALID);
+        // entries whose home lies cyclically in (hole, i] stay put
+        if (((i - home) & mask) < ((i - hole) & mask)) {
+            continue;
+        }
+        index[hole] = index[i];
+        hole = i;
+    }
+    index[hole] = NO_WAY;
+}
+
+/*
+ * touchWay - makes a way the most recently used of its set
+ */
+static inline void touchWay(cache_t* c, size_t set, int way) {
+    size_t first = set * c->E;
+    int mru = c->mru[set];
+
+    if (way == mru) {
+        return;
+    }
+    // the LRU way just needs the ring rotated
+    if (way != c->prev[first + mru]) {
+        // unlink
+        c->next[first + c->prev[first + way]] = c->next[first + way];
+        c->prev[first + c->next[first + way]] = c->prev[first + way];
+        // and relink in front of the old MRU way
+        c->next[first + way] = mru;
+        c->prev[first + way] = c->prev[first + mru];
+        c->next[first + c->prev[first + mru]] = way;
+        c->prev[first + mru] = way;
+    }
+    c->mru[set] = way;
+}
+
+/*
+ * Replacement policies
+ * A policy keeps its state in the cache's recency ring (LRU and FIFO) or
+ * in meta and aux, and is told about every hit, fill and invalidation:
+ *  init       - sets up meta and aux (only called when meta is set)
+ *  hit        - a way of the set was accessed and hit
+ *  victim     - picks the way to replace in a set
+ *  fill       - the victim way now holds a new block
+ *  invalidate - a way was emptied; it should be replaced first
+ * The ring based policies replace empty lines first by construction, the
+ * others check for an empty line (tag 0) before asking for a victim.
+ */
+
+/*
+ * noUpdate - for policies with nothing to update
+ */
+static void noUpdate(cache_t* c, size_t set, int way) {
+    (void)c;
+    (void)set;
+    (void)way;
+}
+
+/*
+ * LRU - the recency ring as is
+ */
+static void lruHit(cache_t* c, size_t set, int way) {
+    touchWay(c, set, way);
+}
+
+static int lruVictim(cache_t* c, size_t set) {
+    return c->prev[set * c->E + c->mru[set]];
+}
+
+static void lruFill(cache_t* c, size_t set, int way) {
+    // the victim is the LRU way, one rotation makes it the MRU way
+    c->mru[set] = way;
+}
+
+static void lruInvalidate(cache_t* c, size_t set, int way) {
+    // make it the MRU way, then rotate the ring one step so it is the LRU
+    touchWay(c, set, way);
+    c->mru[set] = c->next[set * c->E + way];
+}
+
+/*
+ * clearMeta - starts every line's meta at 0
+ */
+static void clearMeta(cache_t* c) {
+    memset(c->meta, 0, ((c->set_mask + 1) * c->E) * c->policy->meta *
+           sizeof(unsigned int));
+}
+
+/*
+ * emptyWay - returns an empty way of the set, -1 if the set is full
+ */
+static inline int emptyWay(cache_t* c, size_t set) {
+    return scanWays(c->tags + set * c->E, c->E, 0);
+}
+
+/*
+ * nextRandom - steps the xorshift generator of a set kept in aux
+ */
+static inline unsigned int nextRandom(cache_t* c, size_t set) {
+    unsigned int x = c->aux[set];
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    c->aux[set] = x;
+    return x;
+}
+
+/*
+ * seedRandom - gives every set its own nonzero generator state, so the
+ * choices do not depend on the order sets are visited in
+ */
+static void seedRandom(cache_t* c) {
+    for (size_t set = 0; set <= c->set_mask; set++) {
+        c->aux[set] = (unsigned int)(set * 0x9e3779b9u) | 1;
+    }
+}
+
+/*
+ * Random - replaces a random way; meta is unused
+ */
+static void randomInit(cache_t* c) {
+    seedRandom(c);
+}
+
+static int randomVictim(cache_t* c, size_t set) {
+    int way = emptyWay(c, set);
+    return (way >= 0) ? way : (int)(nextRandom(c, set) % c->E);
+}
+
+/*
+ * Tree PLRU - a binary tree over the ways (E must be a power of 2); meta
+ * holds the E-1 inner nodes of each set at 1 .. E-1, node n having the
+ * children 2n and 2n+1 and the ways as leaves E .. 2E-1. A node points to
+ * the half the victim is taken from: 0 left, 1 right.
+ */
+
+/*
+ * plruPoint - points the nodes above way away from it (away = 1) or
+ * towards it (away = 0)
+ */
+static inline void plruPoint(cache_t* c, size_t set, int way, int away) {
+    unsigned int* node = c->meta + set * c->E;
+
+    for (unsigned int n = c->E + way; n > 1; n >>= 1) {
+        // n is the left child when even: away from it means right
+        node[n >> 1] = ((n & 1) == 0) == away;
+    }
+}
+
+static void plruHit(cache_t* c, size_t set, int way) {
+    plruPoint(c, set, way, 1);
+}
+
+static int plruVictim(cache_t* c, size_t set) {
+    const unsigned int* node = c->meta + set * c->E;
+    int way = emptyWay(c, set);
+    unsigned int n = 1;
+
+    if (way >= 0) {
+        return way;
+    }
+    while (n < (unsigned int)c->E) {
+        n = 2 * n + node[n];
+    }
+    return n - c->E;
+}
+
+static void plruInvalidate(cache_t* c, size_t set, int way) {
+    plruPoint(c, set, way, 0);
+}
+
+/*
+ * SRRIP and BRRIP - a 2 bit re-reference prediction value per line in
+ * meta: 0 on a hit, the victim is a line at RRPV_MAX (ageing all lines
+ * until there is one). SRRIP fills at RRPV_MAX - 1; BRRIP fills at
+ * RRPV_MAX but at RRPV_MAX - 1 once every BRRIP_THROTTLE fills, chosen at
+ * random, which keeps scans from flushing the cache
+ */
+#define RRPV_MAX 3
+#define BRRIP_THROTTLE 32
+
+static void rripInit(cache_t* c) {
+    size_t lines = (c->set_mask + 1) * c->E;
+
+    for (size_t i = 0; i < lines; i++) {
+        c->meta[i] = RRPV_MAX;
+    }
+    seedRandom(c);
+}
+
+static void rripHit(cache_t* c, size_t set, int way) {
+    c->meta[set * c->E + way] = 0;
+}
+
+static int rripVictim(cache_t* c, size_t set) {
+    unsigned int* rrpv = c->meta + set * c->E;
+    int way = emptyWay(c, set);
+
+    if (way >= 0) {
+        return way;
+    }
+    for (;;) {
+        unsigned int oldest = 0;
+        for (way = 0; way < c->E; way++) {
+            if (rrpv[way] == RRPV_MAX) {
+                return way;
+            }
+            if (rrpv[way] > oldest) {
+                oldest = rrpv[way];
+            }
+        }
+        // age every line by the same amount, so the oldest reach RRPV_MAX
+        for (way = 0; way < c->E; way++) {
+            rrpv[way] += RRPV_MAX - oldest;
+        }
+    }
+}
+
+static void srripFill(cache_t* c, size_t set, int way) {
+    c->meta[set * c->E + way] = RRPV_MAX - 1;
+}
+
+static void brripFill(cache_t* c, size_t set, int way) {
+    c->meta[set * c->E + way] =
+        (nextRandom(c, set) % BRRIP_THROTTLE == 0) ? RRPV_MAX - 1 : RRPV_MAX;
+}
+
+static void rripInvalidate(cache_t* c, size_t set, int way) {
+    c->meta[set * c->E + way] = RRPV_MAX;
+}
+
+/*
+ * LFU - meta counts the hits of each line since it was filled, the victim
+ * is the line with the fewest (the lowest way on ties)
+ */
+static void lfuHit(cache_t* c, size_t set, int way) {
+    unsigned int* count = &c->meta[set * c->E + way];
+    if (*count != UINT_MAX) {
+        (*count)++;
+    }
+}
+
+static int lfuVictim(cache_t* c, size_t set) {
+    const unsigned int* count = c->meta + set * c->E;
+    int victim = emptyWay(c, set);
+
+    if (victim >= 0) {
+        return victim;
+    }
+    victim = 0;
+    for (int way = 1; way < c->E; way++) {
+        if (count[way] < count[victim]) {
+            victim = way;
+        }
+    }
+    return victim;
+}
+
+static void lfuFill(cache_t* c, size_t set, int way) {
+    c->meta[set * c->E + way] = 0;
+}
+
+/* The policies to choose from; FIFO is LRU on a ring ordered by fill time,
+ * i.e. hits change nothing
+ */
+static const policy_t policies[] = {
+    { "lru", 0, NULL, lruHit, lruVictim, lruFill, lruInvalidate },
+    { "fifo", 0, NULL, noUpdate, lruVictim, lruFill, lruInvalidate },
+    { "random", 1, randomInit, noUpdate, randomVictim, noUpdate, noUpdate },
+    { "plru", 1, clearMeta, plruHit, plruVictim, plruHit, plruInvalidate },
+    { "srrip", 1, rripInit, rripHit, rripVictim, srripFill, rripInvalidate },
+    { "brrip", 1, rripInit, rripHit, rripVictim, brripFill, rripInvalidate },
+    { "lfu", 1, clearMeta, lfuHit, lfuVictim, lfuFill, lfuFill },
+};
+
+#define NUM_POLICIES (int)(sizeof(policies) / sizeof(policies[0]))
+
+/* Replacement policy of the simulated caches (-p) */
+static const policy_t* policy = &policies[0];
+
+/*
+ * OPT - Belady's optimal policy; meta holds the number of the access that
+ * next uses each line's block (a count_t, so two words), the victim is the
+ * line used farthest in the future. Needs the next use of every access up
+ * front, which runOpt stores in the accessed line's meta, see -O
+ */
+static int optVictim(cache_t* c, size_t set) {
+    const count_t* next = (const count_t*)c->meta + set * c->E;
+    int victim = emptyWay(c, set);
+
+    if (victim >= 0) {
+        return victim;
+    }
+    victim = 0;
+    for (int way = 1; way < c->E; way++) {
+        if (next[way] > next[victim]) {
+            victim = way;
+        }
+    }
+    return victim;
+}
+
+static const policy_t opt_policy =
+    { "opt", 2, clearMeta, noUpdate, optVictim, noUpdate, noUpdate };
+
+/*
+ * findPolicy - returns the policy called name, NULL if there is none
+ */
+const policy_t* findPolicy(const char* name) {
+    for (int i = 0; i < NUM_POLICIES; i++) {
+        if (strcmp(policies[i].name, name) == 0) {
+            return &policies[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * policyFits - checks that a policy works with E ways (tree PLRU needs a
+ * power of 2)
+ */
+int policyFits(const policy_t* p, int E) {
+    return p->victim != plruVictim || (E & (E - 1)) == 0;
+}
+
+/* TODO - COMPLETE THIS FUNCTION
+ * initCache - 
+ * Allocate data structures to hold info regrading the sets and cache lines
+ * Initialize valid and tag field with 0s.
+ * use S (= 2^s) and E while allocating the data structures here
+ */
+void initCache() {
+    // sets B to be equal to number of Blocks
+    B = pow(2, b);
+    // sets S to be equal to number of sets
+    S = pow(2, s);
+
+    cacheInit(&cache, s, E, b, policy);
+}
+
+
+/* TODO - COMPLETE THIS FUNCTION 
+ * freeCache - free each piece of memory you allocated using malloc 
+ * inside initCache() function
+ */
+void freeCache() {
+    cacheFree(&cache);
+}
+
+/* Outcomes of cacheAccess */
+#define ACCESS_HIT   0
+#define ACCESS_MISS  1   /* miss that filled an empty line */
+#define ACCESS_EVICT 2   /* miss that evicted a valid line */
+
+/*
+ * fillLine - replaces the policy's victim line of a set with tag
+ * Returns ACCESS_MISS or ACCESS_EVICT; the filled line (set * E + way)
+ * goes to *line and, on an eviction, the block that was thrown out to
+ * *victim, unless they are NULL
+ */
+static inline int fillLine(cache_t* c, size_t set, mem_addr_t tag,
+                           size_t* line, victim_t* victim) {
+    int result = ACCESS_MISS;
+    int way = c->policy->victim(c, set);
+    size_t at = set * c->E + way;
+    mem_addr_t* entry = &c->tags[at];
+
+    if (line != NULL) {
+        *line = at;
+    }
+    if (*entry & LINE_VALID) {
+        result = ACCESS_EVICT;
+        if (victim != NULL) {
+            victim->addr = ((((*entry & ~LINE_VALID) << c->s) | set) << c->b);
+            victim->flags = c->flags[at];
+        }
+        c->flags[at] = 0;
+        if (c->index != NULL) {
+            indexRemove(c, set, way, *entry & ~LINE_VALID);
+        }
+    }
+    // updates valid and tag
+    *entry = tag | LINE_VALID;
+    if (c->index != NULL) {
+        indexAdd(c, set, way, tag);
+    }
+    c->policy->fill(c, set, way);
+    return result;
+}
+
+/*
+ * cacheAccess - accesses the block holding addr in cache c
+ * The tag is looked up through the set's index (or a short scan) and the
+ * victim comes from the replacement policy; under LRU it is the LRU end of
+ * the recency ring, so hits, misses and evictions take constant time
+ * Returns ACCESS_HIT, ACCESS_MISS or ACCESS_EVICT; line and victim as in
+ * fillLine
+ */
+static inline int cacheAccess(cache_t* c, mem_addr_t addr, size_t* line,
+                              victim_t* victim) {
+    // grabs the tag and the set of the addr
+    mem_addr_t tag = addr >> (c->s + c->b);
+    size_t set = (addr >> c->b) & c->set_mask;
+
+    int way = findWay(c, set, tag);
+
+    // if address is not found, replace the least recently used line
+    if (way < 0) {
+        return fillLine(c, set, tag, line, victim);
+    }
+    if (line != NULL) {
+        *line = set * c->E + way;
+    }
+    c->policy->hit(c, set, way);
+    return ACCESS_HIT;
+}
+
+/*
+ * cacheFill - brings the block holding addr, which must not be cached yet,
+ * into cache c without counting as an access
+ * Returns ACCESS_MISS or ACCESS_EVICT like cacheAccess
+ */
+static inline int cacheFill(cache_t* c, mem_addr_t addr, size_t* line,
+                            victim_t* victim) {
+    return fillLine(c, (addr >> c->b) & c->set_mask, addr >> (c->s + c->b),
+                    line, victim);
+}
+
+/*
+ * cacheInvalidate - drops the block holding addr from cache c; its line
+ * is the next one the set replaces
+ * Returns 1 if the block was cached, 0 otherwise
+ */
+static inline int cacheInvalidate(cache_t* c, mem_addr_t addr) {
+    mem_addr_t tag = addr >> (c->s + c->b);
+    size_t set = (addr >> c->b) & c->set_mask;
+    int way = findWay(c, set, tag);
+
+    if (way < 0) {
+        return 0;
+    }
+    if (c->index != NULL) {
+        indexRemove(c, set, way, tag);
+    }
+    c->tags[set * c->E + way] = 0;
+    c->flags[set * c->E + way] = 0;
+    c->policy->invalidate(c, set, way);
+    return 1;
+}
+
+/* Type: Block map
+ * Maps block numbers to access numbers, with open addressing and linear
+ * probing; BLOCK_EMPTY marks free slots. Kept at most half full
+ */
+typedef struct block_slot {
+    mem_addr_t block;
+    count_t time;
+} block_slot_t;
+
+typedef struct block_map {
+    block_slot_t* slots;
+    size_t mask;            /* slots - 1, slots being a power of 2 */
+    size_t count;           /* blocks in the map */
+} block_map_t;
+
+#define BLOCK_EMPTY (~0ULL)   /* not a block number, since b > 0 */
+#define BLOCK_MAP_INIT_SIZE 1024
+
+/*
+ * blockMapSlot - returns the slot of block, or the empty slot where it
+ * belongs
+ */
+static inline block_slot_t* blockMapSlot(block_map_t* map, mem_addr_t block) {
+    mem_addr_t h = block * 0x9e3779b97f4a7c15ULL;
+    size_t i = (size_t)(h ^ (h >> 29)) & map->mask;
+
+    while (map->slots[i].block != block && map->slots[i].block != BLOCK_EMPTY) {
+        i = (i + 1) & map->mask;
+    }
+    return &map->slots[i];
+}
+
+/*
+ * blockMapResize - gives the map slots entries (a power of 2), keeping
+ * its blocks
+ */
+static void blockMapResize(block_map_t* map, size_t slots) {
+    block_slot_t* old = map->slots;
+    size_t old_slots = old ? map->mask + 1 : 0;
+
+    map->slots = malloc(slots * sizeof(block_slot_t));
+    if (map->slots == NULL) {
+        fprintf(stderr, "ERROR: could not allocate memory to the heap\n");
+        exit(1);
+    }
+    memset(map->slots, 0xff, slots * sizeof(block_slot_t));
+    map->mask = slots - 1;
+    for (size_t i = 0; i < old_slots; i++) {
+        if (old[i].block != BLOCK_EMPTY) {
+            *blockMapSlot(map, old[i].block) = old[i];
+        }
+    }
+    free(old);
+}
+
+/*
+ * blockMapAdd - fills the empty slot returned by blockMapSlot
+ * The slot may move, so it must not be used afterwards
+ */
+static inline void blockMapAdd(block_map_t* map, block_slot_t* slot,
+                               mem_addr_t block, count_t time) {
+    slot->block = block;
+    slot->time = time;
+    if (2 * ++map->count > map->mask) {
+        blockMapResize(map, 2 * (map->mask + 1));
+    }
+}
+
+/*
+ * Miss classification (-C)
+ * Every miss of the simulated cache is put in one of three classes:
+ *  compulsory - the first access to its block
+ *  capacity   - a fully associative LRU cache of the same size (the
+ *               shadow cache) misses as well
+ *  conflict   - the shadow cache hits, so only the placement in sets
+ *               made it miss
+ * shadow_map holds every block seen so far and maps it to its line in the
+ * shadow cache, or to SHADOW_OUT once it was evicted from there. The lines
+ * form a doubly linked recency list, so each access takes one hash lookup
+ * and constant time; memory grows with the number of distinct blocks.
+ */
+#define SHADOW_OUT (~0ULL)
+
+static int classify_misses = 0;
+static block_map_t shadow_map;
+static mem_addr_t* shadow_block = NULL;     /* block held by each line */
+static unsigned int* shadow_next = NULL;    /* towards the LRU line */
+static unsigned int* shadow_prev = NULL;    /* towards the MRU line */
+static unsigned int shadow_mru = 0;
+static unsigned int shadow_lines = 0;       /* capacity in lines */
+static unsigned int shadow_used = 0;        /* lines filled so far */
+static count_t compulsory_cnt = 0;
+static count_t capacity_cnt = 0;
+static count_t conflict_cnt = 0;
+
+/*
+ * initShadow - sets up an empty shadow cache of lines lines
+ */
+void initShadow(unsigned int lines) {
+    shadow_lines = lines;
+    shadow_block = malloc(lines * sizeof(mem_addr_t));
+    shadow_next = malloc(lines * sizeof(unsigned int));
+    shadow_prev = malloc(lines * sizeof(unsigned int));
+    if (shadow_block == NULL || shadow_next == NULL || shadow_prev == NULL) {
+        fprintf(stderr, "ERROR: could not allocate memory to the heap\n");
+        exit(1);
+    }
+    blockMapResize(&shadow_map, BLOCK_MAP_INIT_SIZE);
+}
+
+/*
+ * freeShadow - releases what initShadow allocated
+ */
+void freeShadow() {
+    free(shadow_block);
+    free(shadow_next);
+    free(shadow_prev);
+    free(shadow_map.slots);
+}
+
+/*
+ * shadowFront - makes line the MRU line of the shadow cache, unlinking it
+ * first if it is linked in already
+ * The list is circular, so the LRU line is shadow_prev[shadow_mru]
+ */
+static inline void shadowFront(unsigned int line, int linked) {
+    if (shadow_used == 1) {
+        shadow_next[line] = shadow_prev[line] = line;
+    } else {
+        if (line == shadow_mru) {
+            return;
+        }
+        // the LRU line just needs the list rotated
+        if (linked && line == shadow_prev[shadow_mru]) {
+            shadow_mru = line;
+            return;
+        }
+        if (linked) {
+            shadow_next[shadow_prev[line]] = shadow_next[line];
+            shadow_prev[shadow_next[line]] = shadow_prev[line];
+        }
+        shadow_next[line] = shadow_mru;
+        shadow_prev[line] = shadow_prev[shadow_mru];
+        shadow_next[shadow_prev[shadow_mru]] = line;
+        shadow_prev[shadow_mru] = line;
+    }
+    shadow_mru = line;
+}
+
+/*
+ * classifyAccess - plays an access to the block holding addr against the
+ * shadow cache and, if the simulated cache missed, classifies the miss
+ */
+static void classifyAccess(mem_addr_t addr, int miss) {
+    mem_addr_t block = addr >> b;
+    block_slot_t* slot = blockMapSlot(&shadow_map, block);
+    int seen = (slot->block == block);
+    unsigned int line;
+
+    if (seen && slot->time != SHADOW_OUT) {
+        // shadow hit
+        shadowFront(slot->time, 1);
+        if (miss) {
+            conflict_cnt++;
+        }
+        return;
+    }
+
+    if (miss) {
+        if (seen) {
+            capacity_cnt++;
+        } else {
+            compulsory_cnt++;
+        }
+    }
+    // shadow miss: take a free line or evict the LRU one
+    if (shadow_used < shadow_lines) {
+        line = shadow_used++;
+        shadowFront(line, 0);
+    } else {
+        line = shadow_prev[shadow_mru];
+        blockMapSlot(&shadow_map, shadow_block[line])->time = SHADOW_OUT;
+        shadowFront(line, 1);
+    }
+    shadow_block[line] = block;
+    if (seen) {
+        slot->time = line;
+    } else {
+        blockMapAdd(&shadow_map, slot, block, line);
+    }
+}
+
+/* TODO - COMPLETE THIS FUNCTION 
+ * accessData - Access data at memory address addr.
+ *   If it is already in cache, increase hit_cnt
+ *   If it is not in cache, bring it in cache, increase miss count.
+ *   Also increase evict_cnt if a line is evicted.
+ *   you will manipulate data structures allocated in initCache() here
+ */
+void accessData(mem_addr_t addr) {
+    int result = cacheAccess(&cache, addr, NULL, NULL);
+
+    switch (result) {
+        case ACCESS_HIT:
+            hit_cnt++;
+            break;
+        case ACCESS_EVICT:
+            evict_cnt++;
+            miss_cnt++;
+            break;
+        default:
+            miss_cnt++;
+    }
+    if (classify_misses) {
+        classifyAccess(addr, result != ACCESS_HIT);
+    }
+}
+
+/*
+ * Parallel mode (-j)
+ * Sets never interact, so the sets are split into contiguous slices, one
+ * per worker thread. The thread parsing the trace routes every access to
+ * the worker owning its set through a single producer, single consumer
+ * ring. Each worker plays its accesses against the shared cache, where it
+ * only ever touches its own sets, and keeps its own counters. The order of
+ * the accesses to any one set is unchanged, so the counts are exactly
+ * those of a serial run.
+ * The parser publishes its ring position every RING_PUBLISH accesses (and
+ * when the ring fills up or the trace ends) to keep the rings' shared
+ * cache lines quiet.
+ */
+#define RING_SIZE (1 << 16)     /* accesses per ring, a power of 2 */
+#define RING_PUBLISH 256        /* a power of 2 dividing RING_SIZE */
+
+typedef struct worker {
+    /* shared: written by the parser, read by the worker */
+    size_t tail __attribute__((aligned(64)));
+    /* shared: written by the worker, read by the parser */
+    size_t head __attribute__((aligned(64)));
+    /* parser only */
+    size_t fill __attribute__((aligned(64)));   /* unpublished tail */
+    size_t seen_head;                           /* last head read */
+    mem_addr_t* ring;
+    /* worker only */
+    pthread_t thread;
+    count_t hits;
+    count_t misses;
+    count_t evictions;
+} worker_t;
+
+static worker_t* workers = NULL;
+static int nworkers = 1;
+static int workers_done = 0;
+
+/*
+ * workerMain - plays the accesses of one worker's ring until the parser
+ * is done and the ring is empty
+ */
+static void* workerMain(void* arg) {
+    worker_t* w = arg;
+    size_t head = 0;
+
+    for (;;) {
+        size_t tail = __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            // the parser publishes every tail before it sets workers_done
+            if (__atomic_load_n(&workers_done, __ATOMIC_ACQUIRE) &&
+                head == __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+        for (; head != tail; head++) {
+            mem_addr_t addr = w->ring[head & (RING_SIZE - 1)];
+            switch (cacheAccess(&cache, addr, NULL, NULL)) {
+                case ACCESS_HIT:
+                    w->hits++;
+                    break;
+                case ACCESS_EVICT:
+                    w->evictions++;
+                    w->misses++;
+                    break;
+                default:
+                    w->misses++;
+            }
+        }
+        __atomic_store_n(&w->head, head, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/*
+ * parallelAccess - hands one access to the worker owning its set
+ */
+static inline void parallelAccess(mem_addr_t addr) {
+    size_t set = (addr >> b) & cache.set_mask;
+    worker_t* w = &workers[(set * nworkers) >> s];
+
+    if (w->fill - w->seen_head == RING_SIZE) {
+        // full: let the worker see everything, then wait for room
+        __atomic_store_n(&w->tail, w->fill, __ATOMIC_RELEASE);
+        while (w->fill - (w->seen_head = __atomic_load_n(&w->head,
+                          __ATOMIC_ACQUIRE)) == RING_SIZE) {
+            sched_yield();
+        }
+    }
+    w->ring[w->fill & (RING_SIZE - 1)] = addr;
+    if ((++w->fill & (RING_PUBLISH - 1)) == 0) {
+        __atomic_store_n(&w->tail, w->fill, __ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * startWorkers - starts n worker threads on the cache (at most one per set)
+ */
+void startWorkers(int n) {
+    if (n > S) {
+        n = S;
+    }
+    nworkers = n;
+    if (posix_memalign((void**)&workers, 64, n * sizeof(worker_t)) != 0) {
+        fprintf(stderr, "ERROR: could not allocate memory to the heap\n");
+        exit(1);
+    }
+    memset(workers, 0, n * sizeof(worker_t));
+    for (int i = 0; i < n; i++) {
+        workers[i].ring = malloc(RING_SIZE * sizeof(mem_addr_t));
+        if (workers[i].ring == NULL) {
+            fprintf(stderr, "ERROR: could not allocate memory to the heap\n");
+            exit(1);
+        }
+        if (pthread_create(&workers[i].thread, NULL, workerMain,
+                           &workers[i]) != 0) {
+            fprintf(stderr, "ERROR: could not start a worker thread\n");
+            exit(1);
+        }
+    }
+}
+
+/*
+ * stopWorkers - flushes the rings, waits for the workers and adds their
+ * counts to the totals
+ */
+void stopWorkers() {
+    for (int i = 0; i < nworkers; i++) {
+        __atomic_store_n(&workers[i].tail, workers[i].fill, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&workers_done, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < nworkers; i++) {
+        pthread_join(workers[i].thread, NULL);
+        hit_cnt += workers[i].hits;
+        miss_cnt += workers[i].misses;
+        evict_cnt += workers[i].evictions;
+        free(workers[i].ring);
+    }
+    free(workers);
+}
+
+/*
+ * Write policies (-w, -a)
+ * By default stores are plain accesses. Modelling writes, a store that
+ * hits either marks its line dirty (write-back), so it is written to the
+ * next level when evicted, or passes its bytes straight on (write-through).
+ * A store that misses either brings the block in first like a load
+ * (write-allocate) or only sends its bytes on (no-write-allocate). Every
+ * block brought in is read from the next level.
+ */
+static int model_writes = 0;
+static int write_through = 0;
+static int write_allocate = 1;
+static count_t writeback_cnt = 0;
+static count_t bytes_read = 0;
+static count_t bytes_written = 0;
+
+/*
+ * Prefetchers (-f)
+ * A prefetcher watches the demand accesses and brings blocks it expects
+ * to be used into the cache ahead of time:
+ *   next    on a miss, or the first use of a prefetched block, fetches the
+ *           blocks that follow it
+ *   stride  learns a stride per instruction (the last "I" line before the
+ *           access, so only text traces have them) and fetches ahead once
+ *           the same stride shows up twice in a row; accesses without an
+ *           instruction fall back to their region
+ *   region  the same per 4 KiB region of memory
+ *   stream  a few stream buffers follow ascending or descending runs of
+ *           blocks; a miss outside every run starts one in the least
+ *           recently used buffer
+ * degree is the number of blocks fetched per trigger and distance how far
+ * ahead the first one is. A prefetched block is only there latency
+ * accesses after it was issued; a demand access that finds it earlier
+ * still misses and counts as late. A prefetched block that is evicted (or
+ * left at the end) without being used counts as useless. Evictions made
+ * by prefetches are counted apart, so evict_cnt stays demand only. The
+ * same trace runs against the cache without a prefetcher to show the
+ * effect.
+ */
+#define PF_NONE   0
+#define PF_NEXT   1
+#define PF_STRIDE 2
+#define PF_REGION 3
+#define PF_STREAM 4
+
+#define PF_TABLE_SIZE 256       /* stride table entries, a power of 2 */
+#define PF_REGION_BITS 12
+#define PF_CONFIDENT 2          /* repeats of a stride before it is used */
+#define PF_STREAMS 4
+
+typedef struct pf_entry {
+    mem_addr_t key;             /* instruction or region */
+    mem_addr_t last;            /* address of its last access */
+    long long stride;
+    int confidence;
+} pf_entry_t;
+
+typedef struct pf_stream {
+    mem_addr_t last;            /* block of the last access in the run */
+    int dir;                    /* +1, -1, or 0 until the run is known */
+    count_t used;               /* when it last moved, for replacement */
+} pf_stream_t;
+
+static int prefetch_kind = PF_NONE;
+static int prefetch_degree = 1;
+static int prefetch_distance = 1;
+static int prefetch_latency = 20;
+static mem_addr_t trace_pc = 0;         /* last instruction in the trace */
+static cache_t pf_base;                 /* the same cache, no prefetcher */
+static count_t* pf_ready = NULL;        /* when each line's prefetch lands */
+static count_t pf_now = 0;              /* demand accesses so far */
+static int pf_trigger = 0;              /* the access missed or was the
+                                           first use of a prefetch */
+static pf_entry_t pf_table[PF_TABLE_SIZE];
+static pf_stream_t pf_streams[PF_STREAMS];
+static count_t pf_issued = 0;
+static count_t pf_useful = 0;
+static count_t pf_late = 0;
+static count_t pf_useless = 0;
+static count_t pf_evictions = 0;        /* by prefetches, not in evict_cnt */
+static count_t pf_base_misses = 0;
+
+/*
+ * parsePrefetcher - reads kind[:degree[:distance[:latency]]] from spec
+ * Returns 0, or -1 if spec is malformed
+ */
+int parsePrefetcher(const char* spec) {
+    static const char* kinds[] = { "next", "stride", "region", "stream" };
+    size_t n = strcspn(spec, ":");
+    char* end;
+
+    for (int i = 0; i < 4; i++) {
+        if (strlen(kinds[i]) == n && strncmp(spec, kinds[i], n) == 0) {
+            prefetch_kind = PF_NEXT + i;
+        }
+    }
+    if (prefetch_kind == PF_NONE) {
+        return -1;
+    }
+    int* fields[] = { &prefetch_degree, &prefetch_distance,
+                      &prefetch_latency };
+    for (int i = 0; i < 3 && spec[n] == ':'; i++) {
+        *fields[i] = strtol(spec + n + 1, &end, 10);
+        n = end - spec;
+    }
+    if (spec[n] != '\0' || prefetch_degree < 1 || prefetch_distance < 1 ||
+        prefetch_latency < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * initPrefetcher - sets up the cache without a prefetcher and the arrival
+ * times; call after initCache
+ */
+void initPrefetcher() {
+    cacheInit(&pf_base, s, E, b, policy);
+    pf_ready = calloc((size_t)S * E, sizeof(count_t));
+    if (pf_ready == NULL) {
+        fprintf(stderr, "ERROR: could not allocate memory to the heap\n");
+        exit(1);
+    }
+}
+
+/*
+ * finishPrefetcher - counts the prefetched blocks nobody used and frees
+ * what initPrefetcher allocated; call before freeCache
+ */
+void finishPrefetcher() {
+    for (size_t i = 0; i < (size_t)S * E; i++) {
+        if (cache.flags[i] & LINE_PREFETCHED) {
+            pf_useless++;
+        }
+    }
+    cacheFree(&pf_base);
+    free(pf_ready);
+}
+
+/*
+ * prefetchBlock - brings the block holding addr into the cache unless it
+ * is already there
+ */
+static void prefetchBlock(mem_addr_t addr) {
+    size_t set = (addr >> b) & cache.set_mask;
+    size_t line;
+    victim_t victim;
+
+    if (findWay(&cache, set, addr >> (s + b)) >= 0) {
+        return;
+    }
+    pf_issued++;
+    bytes_read += B;
+    if (cacheFill(&cache, addr, &line, &victim) == ACCESS_EVICT) {
+        pf_evictions++;
+        if (victim.flags & LINE_PREFETCHED) {
+            pf_useless++;
+        }
+        if (victim.flags & LINE_DIRTY) {
+            writeback_cnt++;
+            bytes_written += B;
+        }
+    }
+    cache.flags[line] = LINE_PREFETCHED;
+    pf_ready[line] = pf_now + prefetch_latency;
+}
+
+/*
+ * prefetchDemand - accounts for a demand access to addr whose cache
+ * access returned result (ACCESS_HIT on line, or a miss filling line unless
+ * fill is 0, evicting victim on ACCESS_EVICT), and replays it against the
+ * cache without a prefetcher
+ * Returns result, or ACCESS_MISS for a prefetched block still on its way
+ */
+static int prefetchDemand(mem_addr_t addr, int result, int fill,
+                          size_t line, const victim_t* victim) {
+    size_t set = (addr >> b) & pf_base.set_mask;
+
+    pf_now++;
+    if (fill) {
+        pf_base_misses +=
+            cacheAccess(&pf_base, addr, NULL, NULL) != ACCESS_HIT;
+    } else {
+        int way = findWay(&pf_base, set, addr >> (s + b));
+        if (way < 0) {
+            pf_base_misses++;
+        } else {
+            pf_base.policy->hit(&pf_base, set, way);
+        }
+    }
+
+    pf_trigger = (result != ACCESS_HIT);
+    if (result == ACCESS_HIT && (cache.flags[line] & LINE_PREFETCHED)) {
+        cache.flags[line] &= ~LINE_PREFETCHED;
+        pf_trigger = 1;
+        if (pf_now < pf_ready[line]) {
+            pf_late++;
+            return ACCESS_MISS;
+        }
+        pf_useful++;
+    } else if (result == ACCESS_EVICT && fill &&
+               (victim->flags & LINE_PREFETCHED)) {
+        pf_useless++;
+    }
+    return result;
+}
+
+/*
+ * prefetchStride - trains the stride table entry of key on addr and
+ * prefetches along its stride once it is confident
+ */
+static void prefetchStride(mem_addr_t key, mem_addr_t addr) {
+    pf_entry_t* e = &pf_table[(key ^ (key >> 8) ^ (key >> 16)) &
+                              (PF_TABLE_SIZE - 1)];
+
+    if (e->key != key) {
+        e->key = key;
+        e->stride = 0;
+        e->confidence = 0;
+    } else {
+        long long stride = (long long)(addr - e->last);
+        if (stride != 0 && stride == e->stride) {
+            if (e->confidence < PF_CONFIDENT) {
+                e->confidence++;
+            }
+        } else {
+            e->stride = stride;
+            e->confidence = 0;
+        }
+    }
+    e->last = addr;
+    if (e->confidence < PF_CONFIDENT) {
+        return;
+    }
+    for (int i = 0; i < prefetch_degree; i++) {
+        prefetchBlock(addr + e->stride * (prefetch_distance + i));
+    }
+}
+
+/*
+ * prefetchStream - follows addr with the stream buffers on a trigger
+ */
+static void prefetchStream(mem_addr_t addr) {
+    mem_addr_t block = addr >> b;
+    pf_stream_t* lru = &pf_streams[0];
+
+    for (int i = 0; i < PF_STREAMS; i++) {
+        pf_stream_t* st = &pf_streams[i];
+        // a run with no direction yet takes the first neighbour it sees
+        int dir = st->dir ? st->dir : (block == st->last + 1) ? 1 :
+            (block == st->last - 1) ? -1 : 0;
+        if (st->used != 0 && dir != 0 && block == st->last + dir) {
+            st->last = block;
+            st->dir = dir;
+            st->used = pf_now;
+            for (int k = 0; k < prefetch_degree; k++) {
+                prefetchBlock((block + dir * (prefetch_distance + k)) << b);
+            }
+            return;
+        }
+        if (st->used < lru->used) {
+            lru = st;
+        }
+    }
+    lru->last = block;
+    lru->dir = 0;
+    lru->used = pf_now;
+}
+
+/*
+ * prefetchIssue - lets the prefetcher react to the demand access to addr
+ */
+static void prefetchIssue(mem_addr_t addr) {
+    switch (prefetch_kind) {
+        case PF_NEXT:
+            if (pf_trigger) {
+                for (int i = 0; i < prefetch_degree; i++) {
+                    prefetchBlock(addr + ((mem_addr_t)(prefetch_distance + i)
+                                          << b));
+                }
+            }
+            break;
+        case PF_STRIDE:
+            if (trace_pc != 0) {
+                prefetchStride(trace_pc, addr);
+                break;
+            }
+            // fall through
+        case PF_REGION:
+            prefetchStride(addr >> PF_REGION_BITS, addr);
+            break;
+        case PF_STREAM:
+            if (pf_trigger) {
+                prefetchStream(addr);
+            }
+            break;
+    }
+}
+
+/*
+ * accessWrite - accesses len bytes at addr for a load (store = 0) or a
+ * store (store = 1), following the write policies and the prefetcher
+ */
+void accessWrite(mem_addr_t addr, int store, unsigned int len) {
+    int fill = !store || write_allocate;
+    int result;
+    size_t line;
+    victim_t victim;
+
+    if (!fill) {
+        size_t set = (addr >> b) & cache.set_mask;
+        int way = findWay(&cache, set, addr >> (s + b));
+        if (way < 0) {
+            if (prefetch_kind) {
+                prefetchDemand(addr, ACCESS_MISS, 0, 0, NULL);
+            }
+            if (classify_misses) {
+                classifyAccess(addr, 1);
+            }
+            miss_cnt++;
+            bytes_written += len;
+            if (prefetch_kind) {
+                prefetchIssue(addr);
+            }
+            return;
+        }
+        line = set * E + way;
+        cache.policy->hit(&cache, set, way);
+        result = ACCESS_HIT;
+    } else {
+        result = cacheAccess(&cache, addr, &line, &victim);
+        if (result != ACCESS_HIT) {
+            bytes_read += B;
+        }
+        if (result == ACCESS_EVICT) {
+            evict_cnt++;
+            if (victim.flags & LINE_DIRTY) {
+                writeback_cnt++;
+                bytes_written += B;
+            }
+        }
+    }
+    if (prefetch_kind) {
+        result = prefetchDemand(addr, result, fill, line, &victim);
+    }
+    if (classify_misses) {
+        classifyAccess(addr, result != ACCESS_HIT);
+    }
+    if (result == ACCESS_HIT) {
+        hit_cnt++;
+    } else {
+        miss_cnt++;
+    }
+    if (store) {
+        if (write_through) {
+            bytes_written += len;
+        } else {
+            cache.flags[line] |= LINE_DIRTY;
+        }
+    }
+    if (prefetch_kind) {
+        prefetchIssue(addr);
+    }
+}
+
+/*
+ * Binary trace format
+ * The file starts with BIN_TRACE_MAGIC, followed by one record per L/S/M
+ * access (instruction fetches are dropped):
+ *  - a head byte: the operation in the low 2 bits (0 = L, 1 = S, 2 = M)
+ *    and the access size in the upper 6 bits; a size of 63 or more is
+ *    stored as 63 and followed by the size as a varint
+ *  - the difference to the previous record's address (0 for the first),
+ *    zigzag encoded as a varint
+ * Varints are little endian base 128: 7 bits per byte, high bit set on all
+ * but the last byte. Typical records take 2 to 4 bytes.
+ */
+#define BIN_TRACE_MAGIC "CSIMTRC1"
+#define BIN_TRACE_MAGIC_LEN 8
+#define BIN_SIZE_ESCAPE 63
+
+/* Binary trace being written by -o, NULL when simulating */
+static FILE* convert_fp = NULL;
+/* Address of the previous record, on each side of the conversion */
+static mem_addr_t convert_prev_addr = 0;
+static mem_addr_t binary_prev_addr = 0;
+
+/*
+ * putVarint - appends v to out as a varint, returns the end of the output
+ */
+static inline unsigned char* putVarint(unsigned char* out,
+                                       unsigned long long v) {
+    while (v >= 0x80) {
+        *out++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *out++ = (unsigned char)v;
+    return out;
+}
+
+/*
+ * getVarint - decodes a varint at *pp, not reading at or past end
+ * Returns 1 and advances *pp on success, 0 if the varint is cut off
+ */
+static inline int getVarint(const unsigned char** pp,
+                            const unsigned char* end, unsigned long long* v) {
+    const unsigned char* q = *pp;
+    unsigned long long value = 0;
+
+    for (int shift = 0; q < end && shift < 64; shift += 7) {
+        unsigned char byte = *q++;
+        value |= (unsigned long long)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *pp = q;
+            *v = value;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * writeBinaryRecord - appends one access to the binary trace being written
+ */
+static void writeBinaryRecord(char op, mem_addr_t addr, unsigned int len) {
+    unsigned char rec[1 + 2 * 10];
+    unsigned char* out = rec;
+    long long delta = (long long)(addr - convert_prev_addr);
+    int code = (op == 'L') ? 0 : (op == 'S') ? 1 : 2;
+
+    if (len < BIN_SIZE_ESCAPE) {
+        *out++ = code | (len << 2);
+    } else {
+        *out++ = code | (BIN_SIZE_ESCAPE << 2);
+        out = putVarint(out, len);
+    }
+    out = putVarint(out, ((unsigned long long)delta << 1) ^
+                         (unsigned long long)(delta >> 63));
+    fwrite(rec, 1, out - rec, convert_fp);
+    convert_prev_addr = addr;
+}
+
+/*
+ * Sweep mode (-S)
+ * Every configuration gets its own cache and counters. Accesses are queued
+ * in sweep_batch and played against one cache after the other a batch at
+ * a time, so each cache stays warm in the host's own caches while it runs
+ */
+typedef struct sweep_cfg {
+    cache_t cache;
+    count_t hits;
+    count_t misses;
+    count_t evictions;
+    count_t straddles;
+} sweep_cfg_t;
+
+#define SWEEP_BATCH 4096
+
+static sweep_cfg_t* sweep_cfgs = NULL;
+static int sweep_n = 0;
+static mem_addr_t sweep_batch[SWEEP_BATCH];
+static unsigned int sweep_lens[SWEEP_BATCH];   /* only used with -x */
+static int sweep_batch_n = 0;
+
+/* Split accesses into the blocks they touch (-x) */
+static int split_straddles = 0;
+static count_t straddle_cnt = 0;
+
+/*
+ * sweepTally - counts the outcome of one access to a configuration
+ */
+static inline void sweepTally(sweep_cfg_t* cfg, int result) {
+    switch (result) {
+        case ACCESS_HIT:
+            cfg->hits++;
+            break;
+        case ACCESS_EVICT:
+            cfg->evictions++;
+            cfg->misses++;
+            break;
+        default:
+            cfg->misses++;
+    }
+}
+
+/*
+ * sweepFlush - plays the queued accesses against every configuration;
+ * with -x each configuration splits them by its own block size
+ */
+static void sweepFlush() {
+    for (int i = 0; i < sweep_n; i++) {
+        sweep_cfg_t* cfg = &sweep_cfgs[i];
+        int cb = cfg->cache.b;
+        for (int j = 0; j < sweep_batch_n; j++) {
+            mem_addr_t addr = sweep_batch[j];
+            if (split_straddles &&
+                (addr & ((1ULL << cb) - 1)) + sweep_lens[j] > (1ULL << cb)) {
+                mem_addr_t last = (addr + sweep_lens[j] - 1) >> cb;
+                cfg->straddles++;
+                for (mem_addr_t blk = addr >> cb; blk <= last; blk++) {
+                    sweepTally(cfg, cacheAccess(&cfg->cache, blk << cb,
+                                                NULL, NULL));
+                }
+                continue;
+            }
+            sweepTally(cfg, cacheAccess(&cfg->cache, addr, NULL, NULL));
+        }
+    }
+    sweep_batch_n = 0;
+}
+
+/*
+ * sweepAccess - queues one access for all configurations
+ */
+static inline void sweepAccess(mem_addr_t addr, unsigned int len) {
+    sweep_lens[sweep_batch_n] = len;
+    sweep_batch[sweep_batch_n++] = addr;
+    if (sweep_batch_n == SWEEP_BATCH) {
+        sweepFlush();
+    }
+}
+
+/*
+ * Stack distance mode (-R)
+ * The stack distance of an access is the number of distinct blocks used
+ * since the previous access to the same block. A fully associative LRU
+ * cache of C lines hits exactly the accesses whose distance is below C, so
+ * one histogram of distances gives the misses of every capacity.
+ * Accesses are numbered 1, 2, ... in trace order. stack_live is a Fenwick
+ * tree over those numbers holding a 1 at the latest access of each block,
+ * so the distance is the number of ones after the block's previous access.
+ * stack_last maps each block to its latest access.
+ * Only the order of the numbers matters, so once the tree is full and at
+ * most half of it is ones, the latest accesses are renumbered 1, 2, ...
+ * (stackCompact) instead of growing the tree; its size stays within a
+ * small multiple of the number of blocks however long the trace is.
+ */
+#define STACK_INIT_SIZE 1024
+
+static int stack_mode = 0;
+static int* stack_live = NULL;      /* Fenwick tree, indexed from 1 */
+static int stack_cap = 0;           /* accesses stack_live can number */
+static int stack_now = 0;           /* number of the latest access */
+static count_t stack_accesses = 0;
+static block_map_t stack_last;
+static int stack_blocks = 0;        /* distinct blocks so far */
+static count_t* stack_hist = NULL;  /* accesses per stack distance */
+static int stack_hist_cap = 0;
+
+/*
+ * stackLiveAdd - adds v at access number i of the Fenwick tree
+ */
+static inline void stackLiveAdd(int i, int v) {
+    for (; i <= stack_cap; i += i & -i) {
+        stack_live[i] += v;
+    }
+}
+
+/*
+ * stackLiveSum - returns the sum over access numbers 1 to i
+ */
+static inline int stackLiveSum(int i) {
+    int sum = 0;
+    for (; i > 0; i -= i & -i) {
+        sum += stack_live[i];
+    }
+    return sum;
+}
+
+/*
+ * stackGrow - doubles the number of accesses the Fenwick tree can hold
+ * Of the new nodes only the last one covers old numbers (all of them)
+ */
+static void stackGrow() {
+    int cap = stack_cap ? 2 * stack_cap : STACK_INIT_SIZE;
+    int* live = realloc(stack_live, (cap + 1) * sizeof(int));
+    if (live == NULL) {
+        fprintf(stderr, "ERROR: could not allocate memory to the heap\n");
+        exit(1);
+    }
+    memset(live + stack_cap + 1, 0, (cap - stack_cap) * sizeof(int));
+    stack_live = live;
+    stack_live[cap] = stackLiveSum(stack_cap);
+    stack_cap = cap;
+}
+
+/*
+ * stackCompact - renumbers the latest accesses of the blocks 1, 2, ... in
+ * the same order; the new number of an access is the number of ones up to
+ * its old one
+ */
+static void stackCompact() {
+    for (size_t i = 0; i <= stack_last.mask; i++) {
+        if (stack_last.slots[i].block != BLOCK_EMPTY) {
+            stack_last.slots[i].time = stackLiveSum(stack_last.slots[i].time);
+        }
+    }
+    // node i covers the numbers after i - (i & -i) up to i
+    for (int i = 1; i <= stack_cap; i++) {
+        int lo = i - (i & -i);
+        int hi = (i < stack_blocks) ? i : stack_blocks;
+        stack_live[i] = (hi > lo) ? hi - lo : 0;
+    }
+    stack_now = stack_blocks;
+}
+
+/*
+ * stackAccess - records the stack distance of one access
+ */
+static void stackAccess(mem_addr_t addr) {
+    mem_addr_t block = addr >> b;
+
+    if (stack_now == stack_cap) {
+        if (2 * stack_blocks <= stack_cap && stack_cap > 0) {
+            stackCompact();
+        } else {
+            stackGrow();
+        }
+    }
+    int now = ++stack_now;
+    stack_accesses++;
+
+    block_slot_t* slot = blockMapSlot(&stack_last, block);
+    if (slot->block == block) {
+        // every block has a one before now, those after last are distinct
+        int last = slot->time;
+        int dist = stack_blocks - stackLiveSum(last);
+        stackLiveAdd(last, -1);
+        stack_hist[dist]++;
+        slot->time = now;
+        if (verbosity)
+            printf("dist:%d ", dist);
+    } else {
+        blockMapAdd(&stack_last, slot, block, now);
+        stack_blocks++;
+        if (verbosity)
+            printf("cold ");
+        // distances stay below the number of blocks
+        if (stack_blocks > stack_hist_cap) {
+            int cap = stack_hist_cap ? 2 * stack_hist_cap : STACK_INIT_SIZE;
+            stack_hist = realloc(stack_hist, cap * sizeof(count_t));
+            if (stack_hist == NULL) {
+                fprintf(stderr, "ERROR: could not allocate memory to the heap\n");
+                exit(1);
+            }
+            memset(stack_hist + stack_hist_cap, 0,
+                   (cap - stack_hist_cap) * sizeof(count_t));
+            stack_hist_cap = cap;
+        }
+    }
+    stackLiveAdd(now, 1);
+}
+
+/*
+ * OPT mode (-O)
+ * Belady's OPT needs to know when each block is used next, so it runs in
+ * three passes with only a chunk of the trace in memory at a time:
+ *  1. while the trace is replayed as usual, the address of every access
+ *     is appended to a temporary file
+ *  2. that file is read backwards a chunk at a time; a block map holding
+ *     the earliest use seen so far of each block gives every access the
+ *     number of the next access to its block, and those numbers go to a
+ *     second temporary file at the matching position
+ *  3. both files are read forwards and played against a cache running
+ *     opt_policy
+ */
+#define OPT_CHUNK (1 << 16)         /* accesses per chunk */
+#define OPT_NEVER ULLONG_MAX        /* next use of a block never used again */
+
+static int opt_fd = -1;             /* addresses, -1 unless -O */
+static mem_addr_t opt_addrs[OPT_CHUNK];
+static count_t opt_next[OPT_CHUNK];
+static int opt_fill = 0;            /* addresses not yet in opt_fd */
+static count_t opt_accesses = 0;
+
+/*
+ * optTransfer - reads or writes n bytes at offset off of fd in full,
+ * exits on failure
+ */
+static void optTransfer(int fd, void* buf, size_t n, off_t off, int write) {
+    char* p = buf;
+
+    while (n > 0) {
+        ssize_t done = write ? pwrite(fd, p, n, off) : pread(fd, p, n, off);
+        if (done <= 0) {
+            fprintf(stderr, "OPT: temporary file: %s\n",
+                    done < 0 ? strerror(errno) : "truncated");
+            exit(1);
+        }
+        p += done;
+        off += done;
+        n -= done;
+    }
+}
+
+/*
+ * optRecord - appends one access to the address file
+ */
+static inline void optRecord(mem_addr_t addr) {
+    opt_addrs[opt_fill++] = addr;
+    if (opt_fill == OPT_CHUNK) {
+        optTransfer(opt_fd, opt_addrs, sizeof(opt_addrs),
+                    (off_t)opt_accesses * sizeof(mem_addr_t), 1);
+        opt_accesses += OPT_CHUNK;
+        opt_fill = 0;
+    }
+}
+
+/*
+ * openTemp - returns the descriptor of a new anonymous temporary file
+ */
+static int openTemp() {
+    FILE* fp = tmpfile();
+    if (fp == NULL) {
+        fprintf(stderr, "OPT: temporary file: %s\n", strerror(errno));
+        exit(1);
+    }
+    // the descriptor outlives the stream, and the file the descriptor
+    int fd = dup(fileno(fp));
+    fclose(fp);
+    return fd;
+}
+
+/*
+ * runOpt - finishes the address file and simulates OPT on it (passes 2
+ * and 3), printing its hits, misses and evictions
+ */
+void runOpt() {
+    optTransfer(opt_fd, opt_addrs, opt_fill * sizeof(mem_addr_t),
+                (off_t)opt_accesses * sizeof(mem_addr_t), 1);
+    opt_accesses += opt_fill;
+    count_t chunks = (opt_accesses + OPT_CHUNK - 1) / OPT_CHUNK;
+    int next_fd = openTemp();
+    block_map_t next_use = { NULL, 0, 0 };
+
+    // pass 2, backwards
+    blockMapResize(&next_use, BLOCK_MAP_INIT_SIZE);
+    for (count_t k = chunks; k-- > 0; ) {
+        count_t first = k * OPT_CHUNK;
+        unsigned int n = (opt_accesses - first < OPT_CHUNK) ?
+            opt_accesses - first : OPT_CHUNK;
+        optTransfer(opt_fd, opt_addrs, n * sizeof(mem_addr_t),
+                    (off_t)first * sizeof(mem_addr_t), 0);
+        for (unsigned int i = n; i-- > 0; ) {
+            mem_addr_t block = opt_addrs[i] >> b;
+            block_slot_t* slot = blockMapSlot(&next_use, block);
+            if (slot->block == block) {
+                opt_next[i] = slot->time;
+                slot->time = first + i;
+            } else {
+                opt_next[i] = OPT_NEVER;
+                blockMapAdd(&next_use, slot, block, first + i);
+            }
+        }
+        optTransfer(next_fd, opt_next, n * sizeof(count_t),
+                    (off_t)first * sizeof(count_t), 1);
+    }
+    free(next_use.slots);
+
+    // pass 3, forwards
+    cache_t opt;
+    count_t hits = 0, misses = 0, evictions = 0;
+    cacheInit(&opt, s, E, b, &opt_policy);
+    for (count_t k = 0; k < chunks; k++) {
+        count_t first = k * OPT_CHUNK;
+        unsigned int n = (opt_accesses - first < OPT_CHUNK) ?
+            opt_accesses - first : OPT_CHUNK;
+        optTransfer(opt_fd, opt_addrs, n * sizeof(mem_addr_t),
+                    (off_t)first * sizeof(mem_addr_t), 0);
+        optTransfer(next_fd, opt_next, n * sizeof(count_t),
+                    (off_t)first * sizeof(count_t), 0);
+        for (unsigned int i = 0; i < n; i++) {
+            size_t line;
+            int result = cacheAccess(&opt, opt_addrs[i], &line, NULL);
+            ((count_t*)opt.meta)[line] = opt_next[i];
+            switch (result) {
+                case ACCESS_HIT:
+                    hits++;
+                    break;
+                case ACCESS_EVICT:
+                    evictions++;
+                    misses++;
+                    break;
+                default:
+                    misses++;
+            }
+        }
+    }
+    cacheFree(&opt);
+    close(next_fd);
+    close(opt_fd);
+
+    printf("opt hits:%llu misses:%llu evictions:%llu\n", hits, misses,
+           evictions);
+}
+
+/*
+ * Hierarchy mode (-L)
+ * levels[0] is the L1 cache, every further level sits below the one before
+ * it and memory comes last. An access goes down the levels until one of
+ * them hits; how the levels it missed in are filled depends on inclusion:
+ *  NINE      - every level that missed fills the block, and evictions
+ *              stay local (non-inclusive, non-exclusive)
+ *  inclusive - like NINE, but a block a level evicts is also invalidated
+ *              in all levels above it (back invalidation)
+ *  exclusive - a block lives in a single level: it moves up into L1 from
+ *              where it hit, and each level's victim drops into the next
+ *              level down (the last level's victim leaves the hierarchy)
+ * Each access costs the latency of every level it looked in plus memory
+ * if all of them missed, which gives the average memory access time
+ */
+#define MAX_LEVELS 8
+
+#define INCL_NINE       0
+#define INCL_INCLUSIVE  1
+#define INCL_EXCLUSIVE  2
+
+typedef struct level {
+    cache_t cache;
+    int latency;            /* cycles to look the level up */
+    count_t hits;
+    count_t misses;
+    count_t evictions;
+    count_t invalidations;  /* blocks dropped by back invalidation */
+} level_t;
+
+static level_t levels[MAX_LEVELS];
+static int nlevels = 0;
+static int inclusion = INCL_NINE;
+static int mem_latency = 100;
+static count_t mem_accesses = 0;
+static count_t level_cycles = 0;
+
+/*
+ * backInvalidate - drops the block at addr, evicted from level lvl, from
+ * every level above it; a smaller block size above means several blocks
+ */
+static void backInvalidate(int lvl, mem_addr_t addr) {
+    mem_addr_t size = 1ULL << levels[lvl].cache.b;
+
+    for (int i = 0; i < lvl; i++) {
+        mem_addr_t step = 1ULL << levels[i].cache.b;
+        for (mem_addr_t a = addr; a < addr + size; a += step) {
+            levels[i].invalidations += cacheInvalidate(&levels[i].cache, a);
+        }
+    }
+}
+
+/*
+ * levelAccess - plays one access against the hierarchy
+ */
+static void levelAccess(mem_addr_t addr) {
+    int hit_level = nlevels;
+    victim_t victim;
+
+    if (inclusion == INCL_EXCLUSIVE) {
+        // L1 takes the block in any case
+        level_cycles += levels[0].latency;
+        int first = cacheAccess(&levels[0].cache, addr, NULL, &victim);
+        if (first == ACCESS_HIT) {
+            levels[0].hits++;
+            return;
+        }
+        levels[0].misses++;
+        // find it below, taking it out of the level that has it
+        for (int i = 1; i < nlevels; i++) {
+            level_cycles += levels[i].latency;
+            if (cacheInvalidate(&levels[i].cache, addr)) {
+                levels[i].hits++;
+                hit_level = i;
+                break;
+            }
+            levels[i].misses++;
+        }
+        // victims drop down a level for as long as they evict another one
+        if (first == ACCESS_EVICT) {
+            levels[0].evictions++;
+            for (int i = 1; i < nlevels &&
+                 cacheFill(&levels[i].cache, victim.addr, NULL, &victim) ==
+                 ACCESS_EVICT; i++) {
+                levels[i].evictions++;
+            }
+        }
+    } else {
+        for (int i = 0; i < nlevels; i++) {
+            level_cycles += levels[i].latency;
+            int result = cacheAccess(&levels[i].cache, addr, NULL, &victim);
+            if (result == ACCESS_HIT) {
+                levels[i].hits++;
+                hit_level = i;
+                break;
+            }
+            levels[i].misses++;
+            if (result == ACCESS_EVICT) {
+                levels[i].evictions++;
+                if (inclusion == INCL_INCLUSIVE && i > 0) {
+                    backInvalidate(i, victim.addr);
+                }
+            }
+        }
+    }
+    if (hit_level == nlevels) {
+        level_cycles += mem_latency;
+        mem_accesses++;
+    }
+}
+
+/*
+ * Set sampling (-y)
+ * Sets never interact, so a cache's miss ratio can be estimated from a
+ * subset of its sets. About one set in every sample_rate, picked by
+ * hashing the set number, is simulated in a compact cache holding just
+ * those sets; accesses to the other sets are only counted. The sampled
+ * miss and eviction ratios are applied to that exact access count, and
+ * the miss ratio comes with a 95% confidence interval from the spread of
+ * the per-set miss ratios (a ratio estimator with the finite population
+ * correction).
+ */
+static int sample_rate = 0;
+static int* sample_index = NULL;        /* compact set of every set, or -1 */
+static size_t sample_sets = 0;
+static cache_t sample_cache;
+static count_t* sample_accesses = NULL; /* per compact set */
+static count_t* sample_misses = NULL;
+static count_t sample_total = 0;        /* every access, sampled or not */
+static double sample_ratio = 0;         /* miss ratio of the sampled sets */
+static double sample_margin = 0;        /* half the 95% interval */
+
+/*
+ * initSampling - picks the sampled sets and sets up the compact cache
+ */
+void initSampling() {
+    int cs = 0;
+
+    B = 1 << b;
+    S = 1 << s;
+    sample_index = malloc(S * sizeof(int));
+    if (sample_index == NULL) {
+        fprintf(stderr, "ERROR: could not allocate memory to the heap\n");
+        exit(1);
+    }
+    for (int i = 0; i < S; i++) {
+        mem_addr_t h = (mem_addr_t)i * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 29;
+        sample_index[i] = (h % sample_rate == 0) ? (int)sample_sets++ : -1;
+    }
+    // a cache with fewer sets than the rate may have none picked
+    if (sample_sets == 0) {
+        sample_index[0] = 0;
+        sample_sets = 1;
+    }
+    while ((1ULL << cs) < sample_sets) {
+        cs++;
+    }
+    cacheInit(&sample_cache, cs, E, b, policy);
+    sample_accesses = calloc(sample_sets, sizeof(count_t));
+    sample_misses = calloc(sample_sets, sizeof(count_t));
+    if (sample_accesses == NULL || sample_misses == NULL) {
+        fprintf(stderr, "ERROR: could not allocate memory to the heap\n");
+        exit(1);
+    }
+}
+
+/*
+ * sampleAccess - plays the access to addr if its set is sampled
+ */
+static inline void sampleAccess(mem_addr_t addr) {
+    int idx = sample_index[(addr >> b) & (S - 1)];
+
+    sample_total++;
+    if (idx < 0) {
+        return;
+    }
+    // the same tag, in the set's place in the compact cache
+    mem_addr_t tag = addr >> (s + b);
+    int result = cacheAccess(&sample_cache,
+                             ((tag << sample_cache.s) | idx) << b,
+                             NULL, NULL);
+    sample_accesses[idx]++;
+    if (result != ACCESS_HIT) {
+        sample_misses[idx]++;
+        evict_cnt += (result == ACCESS_EVICT);
+    }
+}
+
+/*
+ * finishSampling - estimates hit_cnt, miss_cnt and evict_cnt from the
+ * sampled ratios and the access count, works out the miss ratio's
+ * confidence interval and frees what initSampling allocated
+ */
+void finishSampling() {
+    count_t accesses = 0, misses = 0;
+    double scale = (double)S / sample_sets;
+
+    for (size_t i = 0; i < sample_sets; i++) {
+        accesses += sample_accesses[i];
+        misses += sample_misses[i];
+    }
+    sample_ratio = accesses ? (double)misses / accesses : 0;
+    double mean = (double)accesses / sample_sets;
+    double sum_sq = 0;
+    for (size_t i = 0; i < sample_sets; i++) {
+        double d = sample_misses[i] - sample_ratio * sample_accesses[i];
+        sum_sq += d * d;
+    }
+    // a single sampled set (out of several) says nothing of the spread
+    if (sample_sets == 1 && scale > 1) {
+        sample_margin = NAN;
+    } else if (sample_sets > 1 && mean > 0) {
+        sample_margin = 1.96 * sqrt(sum_sq / (sample_sets - 1) /
+                                    sample_sets * (1 - 1.0 / scale)) / mean;
+    }
+
+    miss_cnt = llround(sample_total * sample_ratio);
+    hit_cnt = sample_total - miss_cnt;
+    evict_cnt = accesses ? llround(sample_total * ((double)evict_cnt /
+                                                  accesses)) : 0;
+
+    cacheFree(&sample_cache);
+    free(sample_index);
+    free(sample_accesses);
+    free(sample_misses);
+}
+
+/*
+ * TLB (-T, -z, -u)
+ * The same accesses also go through a TLB of one or more levels, each an
+ * LRU cache of page translations (an entry per page, so a cache_t with
+ * page sized blocks). A miss in a level looks in the next one, and a miss
+ * in the last one walks the page table. A fraction of the 2 MiB regions
+ * of memory, picked by hashing the region, is mapped with huge pages; a
+ * huge page takes a single entry, kept apart from the small pages by a
+ * tag bit that no user address has.
+ */
+#define MAX_TLB_LEVELS 4
+#define HUGE_PAGE_BITS 21
+#define HUGE_PAGE_TAG (1ULL << 62)
+
+typedef struct tlb_level {
+    cache_t cache;
+    count_t hits;
+    count_t misses;
+    count_t evictions;
+} tlb_level_t;
+
+static tlb_level_t tlbs[MAX_TLB_LEVELS];
+static int ntlbs = 0;
+static int page_bits = 12;
+static double huge_fraction = 0;
+static count_t page_walks = 0;
+static count_t huge_accesses = 0;
+
+/*
+ * parseTLB - sets up the TLB from spec, one entries:ways term per level
+ * separated by ';' or blanks, first level first
+ * Returns 0 on success, -1 on bad input
+ */
+int parseTLB(char* spec) {
+    char* save = NULL;
+
+    for (char* term = strtok_r(spec, "; \t", &save); term != NULL;
+         term = strtok_r(NULL, "; \t", &save)) {
+        int entries, ways, ts = 0;
+        if (ntlbs == MAX_TLB_LEVELS ||
+            sscanf(term, "%d:%d", &entries, &ways) != 2 || ways < 1 ||
+            ways >= NO_WAY || entries < ways || entries % ways != 0) {
+            return -1;
+        }
+        // the sets must be a power of 2
+        while ((ways << ts) < entries) {
+            ts++;
+        }
+        if ((ways << ts) != entries) {
+            return -1;
+        }
+        tlb_level_t* t = &tlbs[ntlbs++];
+        memset(t, 0, sizeof(*t));
+        cacheInit(&t->cache, ts, ways, page_bits, &policies[0]);
+    }
+    return (ntlbs > 0) ? 0 : -1;
+}
+
+/*
+ * isHugePage - tells whether the 2 MiB region holding addr uses huge pages
+ */
+static inline int isHugePage(mem_addr_t addr) {
+    mem_addr_t h = (addr >> HUGE_PAGE_BITS) * 0x9e3779b97f4a7c15ULL;
+    return (double)((h ^ (h >> 29)) >> 11) < huge_fraction * (1ULL << 53);
+}
+
+/*
+ * tlbAccess - translates addr through the TLB levels
+ */
+static void tlbAccess(mem_addr_t addr) {
+    // an address standing for the page: a huge page's number, at the
+    // small page size and tagged
+    if (huge_fraction > 0 && isHugePage(addr)) {
+        huge_accesses++;
+        addr = ((addr >> HUGE_PAGE_BITS) << page_bits) | HUGE_PAGE_TAG;
+    }
+    for (int i = 0; i < ntlbs; i++) {
+        int result = cacheAccess(&tlbs[i].cache, addr, NULL, NULL);
+        if (result == ACCESS_HIT) {
+            tlbs[i].hits++;
+            return;
+        }
+        tlbs[i].misses++;
+        tlbs[i].evictions += (result == ACCESS_EVICT);
+    }
+    page_walks++;
+}
+
+/*
+ * printTLB - prints the statistics of every TLB level and frees them
+ */
+void printTLB() {
+    for (int i = 0; i < ntlbs; i++) {
+        printf("TLB%d hits:%llu misses:%llu evictions:%llu\n", i + 1,
+               tlbs[i].hits, tlbs[i].misses, tlbs[i].evictions);
+        cacheFree(&tlbs[i].cache);
+    }
+    printf("page walks:%llu huge page accesses:%llu\n", page_walks,
+           huge_accesses);
+}
+
+/*
+ * Coherence mode (-N)
+ * Every core has a private cache with the geometry and policy of -s -E -b
+ * -p, kept coherent by snooping with MSI or MESI. A line's state lives in
+ * its flags: LINE_DIRTY is Modified, LINE_EXCLUSIVE Exclusive and neither
+ * Shared. A load miss takes the block from the other caches' copies
+ * (writing a Modified one back) and ends up Shared, or Exclusive under
+ * MESI when nobody else has it. A store needs the only copy: a miss reads
+ * for ownership and a hit on a Shared line upgrades, both invalidating
+ * the other copies, while a hit on an Exclusive line silently becomes
+ * Modified.
+ * A miss on a block the core lost to an invalidation is a coherence miss.
+ * Each core keeps, per block lost that way, a mask of the bytes the other
+ * cores stored to since (one bit per byte of a 64 byte block, coarser for
+ * larger ones); a coherence miss whose bytes are in it is true sharing,
+ * otherwise it is false sharing and counts against the block's hot spot.
+ */
+#define MAX_CORES 64
+#define HOT_LINES 10
+
+typedef struct core {
+    cache_t cache;
+    block_map_t lost;       /* blocks invalidated here, bytes since */
+    count_t hits;
+    count_t misses;
+    count_t coherence;      /* misses on blocks lost to invalidation */
+    count_t evictions;
+    count_t upgrades;       /* store hits on Shared lines */
+    count_t invalidated;    /* lines other cores invalidated */
+    count_t writebacks;     /* Modified lines evicted or snooped */
+} core_t;
+
+static core_t* cores = NULL;
+static int ncores = 0;
+static int mesi = 1;
+static int trace_core = 0;          /* core of the access being parsed */
+static int thread_column = 0;       /* text records name their thread */
+static int threads_dropped = 0;     /* converting lost thread numbers */
+static count_t true_sharing_cnt = 0;
+static count_t false_sharing_cnt = 0;
+static block_map_t false_sharing;   /* false sharing misses per block */
+
+/*
+ * initCores - gives n cores a private cache each
+ */
+void initCores(int n) {
+    cores = calloc(n, sizeof(core_t));
+    if (cores == NULL) {
+        fprintf(stderr, "ERROR: could not allocate memory to the heap\n");
+        exit(1);
+    }
+    ncores = n;
+    for (int i = 0; i < n; i++) {
+        cacheInit(&cores[i].cache, s, E, b, policy);
+        blockMapResize(&cores[i].lost, BLOCK_MAP_INIT_SIZE);
+    }
+    blockMapResize(&false_sharing, BLOCK_MAP_INIT_SIZE);
+}
+
+/*
+ * freeCores - releases what initCores allocated
+ */
+void freeCores() {
+    for (int i = 0; i < ncores; i++) {
+        cacheFree(&cores[i].cache);
+        free(cores[i].lost.slots);
+    }
+    free(cores);
+    free(false_sharing.slots);
+}
+
+/*
+ * byteMask - the bits standing for len bytes at addr within its block
+ */
+static inline count_t byteMask(mem_addr_t addr, unsigned int len) {
+    int shift = (b > 6) ? b - 6 : 0;
+    unsigned int first = (addr & ((1ULL << b) - 1)) >> shift;
+    unsigned int last = ((addr & ((1ULL << b) - 1)) + (len ? len : 1) - 1)
+        >> shift;
+
+    if (last > 63) {
+        last = 63;
+    }
+    return (~0ULL >> (63 - last)) & (~0ULL << first);
+}
+
+/*
+ * snoopLoad - lets the cores other than c see a load miss on addr
+ * Returns 1 if any of them has a copy, which is Shared from now on
+ */
+static int snoopLoad(int c, mem_addr_t addr) {
+    size_t set = (addr >> b) & cores[c].cache.set_mask;
+    mem_addr_t tag = addr >> (s + b);
+    int shared = 0;
+
+    for (int i = 0; i < ncores; i++) {
+        int way = (i == c) ? -1 : findWay(&cores[i].cache, set, tag);
+        if (way >= 0) {
+            unsigned char* state = &cores[i].cache.flags[set * E + way];
+            if (*state & LINE_DIRTY) {
+                cores[i].writebacks++;
+            }
+            *state = 0;
+            shared = 1;
+        }
+    }
+    return shared;
+}
+
+/*
+ * snoopStore - lets the cores other than c see a store of bytes (a byte
+ * mask) to addr: their copies are invalidated and the cores that lost the
+ * block note the bytes
+ */
+static void snoopStore(int c, mem_addr_t addr, count_t bytes) {
+    size_t set = (addr >> b) & cores[c].cache.set_mask;
+    mem_addr_t tag = addr >> (s + b);
+    mem_addr_t block = addr >> b;
+
+    for (int i = 0; i < ncores; i++) {
+        if (i == c) {
+            continue;
+        }
+        core_t* o = &cores[i];
+        int way = findWay(&o->cache, set, tag);
+        block_slot_t* slot = blockMapSlot(&o->lost, block);
+        if (way >= 0) {
+            if (o->cache.flags[set * E + way] & LINE_DIRTY) {
+                o->writebacks++;
+            }
+            cacheInvalidate(&o->cache, addr);
+            o->invalidated++;
+            if (slot->block == block) {
+                slot->time = bytes;
+            } else {
+                blockMapAdd(&o->lost, slot, block, bytes);
+            }
+        } else if (slot->block == block && slot->time != 0) {
+            slot->time |= bytes;
+        }
+    }
+}
+
+/*
+ * coreAccess - plays a load (store = 0) or store (store = 1) of len bytes
+ * at addr on core c
+ */
+static void coreAccess(int c, mem_addr_t addr, unsigned int len, int store) {
+    core_t* me = &cores[c];
+    mem_addr_t block = addr >> b;
+    count_t bytes = byteMask(addr, len);
+    size_t line;
+    victim_t victim;
+    int result = cacheAccess(&me->cache, addr, &line, &victim);
+    unsigned char* state = &me->cache.flags[line];
+
+    if (result == ACCESS_HIT) {
+        me->hits++;
+        if (store) {
+            if (!(*state & (LINE_DIRTY | LINE_EXCLUSIVE))) {
+                me->upgrades++;
+            }
+            // only a Shared line has other copies to invalidate, but the
+            // cores that lost the block see the bytes in any case
+            snoopStore(c, addr, bytes);
+            *state = LINE_DIRTY;
+        }
+        return;
+    }
+
+    me->misses++;
+    if (result == ACCESS_EVICT) {
+        me->evictions++;
+        if (victim.flags & LINE_DIRTY) {
+            me->writebacks++;
+        }
+    }
+    block_slot_t* slot = blockMapSlot(&me->lost, block);
+    if (slot->block == block && slot->time != 0) {
+        me->coherence++;
+        if (slot->time & bytes) {
+            true_sharing_cnt++;
+        } else {
+            false_sharing_cnt++;
+            block_slot_t* hot = blockMapSlot(&false_sharing, block);
+            if (hot->block == block) {
+                hot->time++;
+            } else {
+                blockMapAdd(&false_sharing, hot, block, 1);
+            }
+        }
+        slot->time = 0;
+    }
+    if (store) {
+        snoopStore(c, addr, bytes);
+        *state = LINE_DIRTY;
+    } else {
+        *state = (snoopLoad(c, addr) || !mesi) ? 0 : LINE_EXCLUSIVE;
+    }
+}
+
+/*
+ * replayBlock - plays one L/S/M access to a single block
+ */
+static inline void replayBlock(char op, mem_addr_t addr, unsigned int len) {
+    if (ntlbs > 0) {
+        if (op == 'M') {
+            tlbAccess(addr);
+        }
+        tlbAccess(addr);
+    }
+    if (stack_mode) {
+        if (op == 'M') {
+            stackAccess(addr);
+        }
+        stackAccess(addr);
+    } else if (nlevels > 0) {
+        if (op == 'M') {
+            levelAccess(addr);
+        }
+        levelAccess(addr);
+    } else if (ncores > 0) {
+        if (op == 'M') {
+            coreAccess(trace_core, addr, len, 0);
+        }
+        coreAccess(trace_core, addr, len, op != 'L');
+    } else if (sweep_n > 0) {
+        // each configuration splits straddling accesses on its own
+        if (op == 'M') {
+            sweepAccess(addr, len);
+        }
+        sweepAccess(addr, len);
+    } else if (sample_rate > 0) {
+        if (op == 'M') {
+            sampleAccess(addr);
+        }
+        sampleAccess(addr);
+    } else if (nworkers > 1) {
+        if (op == 'M') {
+            parallelAccess(addr);
+        }
+        parallelAccess(addr);
+    } else {
+        if (model_writes || prefetch_kind) {
+            // a modify loads, then stores
+            if (op == 'M') {
+                accessWrite(addr, 0, len);
+            }
+            accessWrite(addr, op != 'L', len);
+        } else {
+            // if op is equal to M
+            if (op == 'M') {
+                // access the Data for addr
+                accessData(addr);
+            }
+            // access the Data for addr
+            accessData(addr);
+        }
+        if (opt_fd >= 0) {
+            if (op == 'M') {
+                optRecord(addr);
+            }
+            optRecord(addr);
+        }
+    }
+}
+
+/*
+ * replayAccess - plays one L/S/M record from the trace against the cache
+ * (or, when converting, writes it to the binary trace)
+ * With -x an access that runs over the end of its block is split into one
+ * access per block it touches, each with its share of the bytes; a sweep
+ * does that per configuration, a hierarchy at the L1 block size
+ */
+static inline void replayAccess(char op, mem_addr_t addr, unsigned int len) {
+    if (convert_fp != NULL) {
+        writeBinaryRecord(op, addr, len);
+        return;
+    }
+    if (verbosity)
+        printf("%c %llx,%u ", op, addr, len);
+
+    mem_addr_t block_mask = ((1ULL << (nlevels ? levels[0].cache.b : b)) - 1);
+    // the common case, an access within one block, costs one test
+    if (!split_straddles || sweep_n > 0 ||
+        (addr & block_mask) + len <= block_mask + 1) {
+        replayBlock(op, addr, len);
+    } else {
+        mem_addr_t end = addr + len;
+        // counted per access, so a modify counts twice like its hits
+        straddle_cnt += (op == 'M') ? 2 : 1;
+        while (addr < end) {
+            mem_addr_t next = (addr | block_mask) + 1;
+            mem_addr_t stop = (next < end) ? next : end;
+            replayBlock(op, addr, stop - addr);
+            addr = next;
+        }
+    }
+
+    if (verbosity)
+        printf("\n");
+}
+
+/* Value of each hex digit character, -1 for anything else */
+static signed char hex_value[256];
+
+/*
+ * initHexValues - fills in hex_value
+ */
+static void initHexValues() {
+    memset(hex_value, -1, sizeof(hex_value));
+    for (int i = 0; i < 10; i++) {
+        hex_value['0' + i] = i;
+    }
+    for (int i = 0; i < 6; i++) {
+        hex_value['a' + i] = 10 + i;
+        hex_value['A' + i] = 10 + i;
+    }
+}
+
+/*
+ * parseLines - replays every complete line in [p, end); if last is set the
+ * text after the final newline is a line as well
+ * Records look like " L 7ff000398,8": the operation is the second
+ * character and the address and size start at the fourth, as Valgrind's
+ * lackey writes them; anything else is skipped, except that a stride
+ * prefetcher keeps the address of the last "I" line as the instruction
+ * In coherence mode with a single trace, a number after the size is the
+ * thread that made the access (" L 7ff000398,8 3"), mapped onto the cores;
+ * converting notes whether there were any, since binary records have none
+ * Returns the start of the unfinished line at the end, or end
+ */
+static const char* parseLines(const char* p, const char* end, int last) {
+    while (p < end) {
+        const unsigned char* q = (const unsigned char*)p;
+        const unsigned char* stop = (const unsigned char*)end;
+        char op = (end - p > 3 && p[0] != '\n' && p[1] != '\n') ? p[1] : 0;
+        int pc = (op == ' ' && p[0] == 'I' && prefetch_kind == PF_STRIDE);
+        mem_addr_t addr = 0;
+        unsigned int len = 0;
+
+        // fields are decoded as they go by, the newline is found afterwards
+        if (op == 'S' || op == 'L' || op == 'M' || pc) {
+            q += 3;
+            // same leniency as "%llx": blanks and an optional 0x prefix
+            while (q < stop && (*q == ' ' || *q == '\t')) {
+                q++;
+            }
+            if (stop - q > 2 && q[0] == '0' && (q[1] | 0x20) == 'x' &&
+                hex_value[q[2]] >= 0) {
+                q += 2;
+            }
+            while (q < stop && hex_value[*q] >= 0) {
+                addr = (addr << 4) | hex_value[*q++];
+            }
+            if (q < stop && *q == ',') {
+                for (q++; q < stop && *q >= '0' && *q <= '9'; q++) {
+                    len = len * 10 + (*q - '0');
+                }
+            }
+            if (thread_column) {
+                unsigned int tid = 0;
+                while (q < stop && (*q == ' ' || *q == '\t')) {
+                    q++;
+                }
+                const unsigned char* digits = q;
+                for (; q < stop && *q >= '0' && *q <= '9'; q++) {
+                    tid = tid * 10 + (*q - '0');
+                }
+                if (ncores > 0) {
+                    trace_core = tid % ncores;
+                } else if (q != digits) {
+                    threads_dropped = 1;
+                }
+            }
+        }
+
+        const unsigned char* eol = (q < stop && *q == '\n') ? q :
+            memchr(q, '\n', stop - q);
+        if (eol == NULL) {
+            if (!last) {
+                return p;
+            }
+            eol = stop;
+        }
+        if (op == 'S' || op == 'L' || op == 'M') {
+            replayAccess(op, addr, len);
+        } else if (pc) {
+            trace_pc = addr;
+        }
+        p = (const char*)eol + 1;
+    }
+    return end;
+}
+
+/*
+ * parseBinary - replays every complete binary record in [p, end); if last
+ * is set, a record cut off at the end means the trace is corrupt
+ * Returns the start of the unfinished record at the end, or end
+ */
+static const char* parseBinary(const char* p, const char* end, int last) {
+    const unsigned char* q = (const unsigned char*)p;
+    const unsigned char* stop = (const unsigned char*)end;
+
+    if (thread_column && ncores > 0) {
+        fprintf(stderr, "binary trace: records have no thread, -N needs a "
+                "text trace or one trace per core\n");
+        exit(1);
+    }
+    while (q < stop) {
+        const unsigned char* rec = q;
+        unsigned int head = *q++;
+        unsigned long long len = head >> 2;
+        unsigned long long zigzag;
+
+        if ((len == BIN_SIZE_ESCAPE && !getVarint(&q, stop, &len)) ||
+            !getVarint(&q, stop, &zigzag)) {
+            if (last) {
+                fprintf(stderr, "binary trace: truncated record\n");
+                exit(1);
+            }
+            return (const char*)rec;
+        }
+        if ((head & 3) == 3) {
+            fprintf(stderr, "binary trace: bad operation in record\n");
+            exit(1);
+        }
+        binary_prev_addr += (zigzag >> 1) ^ -(zigzag & 1);
+        replayAccess("LSM"[head & 3], binary_prev_addr, (unsigned int)len);
+    }
+    return end;
+}
+
+/*
+ * isBinaryTrace - tells whether the n bytes at p start a binary trace
+ */
+static int isBinaryTrace(const char* p, size_t n) {
+    return n >= BIN_TRACE_MAGIC_LEN &&
+        memcmp(p, BIN_TRACE_MAGIC, BIN_TRACE_MAGIC_LEN) == 0;
+}
+
+/* Type: Trace parser, see parseLines and parseBinary */
+typedef const char* (*parse_fn_t)(const char* p, const char* end, int last);
+
+/* Size of the read() buffers used when the trace cannot be mapped */
+#define TRACE_BUF_SIZE (1 << 20)
+/* Room in front of a buffer for the unfinished line of the one before;
+ * longer lines cannot be records and are dropped */
+#define TRACE_LINE_ROOM 4096
+
+/*
+ * Type: Trace buffer
+ * A trace that cannot be mapped is read by a reader thread into two
+ * buffers in turn, so reading the next chunk overlaps parsing this one.
+ * A buffer is full from when the reader hands it over until the parser
+ * gives it back
+ */
+typedef struct trace_buf {
+    char* data;             /* TRACE_LINE_ROOM bytes, then the chunk */
+    size_t len;             /* bytes in the chunk, 0 at the end */
+    int full;
+} trace_buf_t;
+
+typedef struct trace_reader {
+    int fd;
+    const char* name;
+    trace_buf_t bufs[2];
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} trace_reader_t;
+
+/*
+ * readerMain - fills the buffers in turn until the end of the trace,
+ * handing over an empty chunk last
+ */
+static void* readerMain(void* arg) {
+    trace_reader_t* r = arg;
+
+    for (int i = 0;; i ^= 1) {
+        trace_buf_t* buf = &r->bufs[i];
+        pthread_mutex_lock(&r->lock);
+        while (buf->full) {
+            pthread_cond_wait(&r->changed, &r->lock);
+        }
+        pthread_mutex_unlock(&r->lock);
+
+        // a pipe hands out what it has, so keep reading until full
+        size_t len = 0;
+        while (len < TRACE_BUF_SIZE) {
+            ssize_t n = read(r->fd, buf->data + TRACE_LINE_ROOM + len,
+                             TRACE_BUF_SIZE - len);
+            if (n == 0) {
+                break;
+            }
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fprintf(stderr, "%s: %s\n", r->name, strerror(errno));
+                exit(1);
+            }
+            len += n;
+        }
+
+        pthread_mutex_lock(&r->lock);
+        buf->len = len;
+        buf->full = 1;
+        pthread_cond_broadcast(&r->changed);
+        pthread_mutex_unlock(&r->lock);
+        if (len == 0) {
+            return NULL;
+        }
+    }
+}
+
+/*
+ * readTrace - parses the trace read from fd, chunk by chunk, carrying the
+ * unfinished line at the end of a chunk over to the next one; a line too
+ * long to carry is skipped up to its newline
+ */
+static void readTrace(int fd, const char* name) {
+    trace_reader_t r;
+    pthread_t reader;
+    char carry[TRACE_LINE_ROOM];
+    size_t kept = 0;
+    int skipping = 0;       /* inside a line too long to be a record */
+    parse_fn_t parse = NULL;
+
+    memset(&r, 0, sizeof(r));
+    r.fd = fd;
+    r.name = name;
+    pthread_mutex_init(&r.lock, NULL);
+    pthread_cond_init(&r.changed, NULL);
+    for (int i = 0; i < 2; i++) {
+        r.bufs[i].data = malloc(TRACE_LINE_ROOM + TRACE_BUF_SIZE);
+        if (r.bufs[i].data == NULL) {
+            fprintf(stderr, "ERROR: could not allocate memory to the heap\n");
+            exit(1);
+        }
+    }
+    if (pthread_create(&reader, NULL, readerMain, &r) != 0) {
+        fprintf(stderr, "ERROR: could not start the reader thread\n");
+        exit(1);
+    }
+
+    for (int i = 0;; i ^= 1) {
+        trace_buf_t* buf = &r.bufs[i];
+        pthread_mutex_lock(&r.lock);
+        while (!buf->full) {
+            pthread_cond_wait(&r.changed, &r.lock);
+        }
+        pthread_mutex_unlock(&r.lock);
+
+        // the carried over line goes right in front of the chunk
+        char* start = buf->data + TRACE_LINE_ROOM - kept;
+        const char* end = buf->data + TRACE_LINE_ROOM + buf->len;
+        memcpy(start, carry, kept);
+        if (skipping) {
+            const char* eol = memchr(start, '\n', end - start);
+            skipping = (eol == NULL);
+            start = skipping ? (char*)end : (char*)eol + 1;
+        }
+        if (buf->len == 0) {
+            (parse != NULL ? parse : parseLines)(start, end, 1);
+            break;
+        }
+        // the format is known once the magic could have been read
+        if (parse == NULL && end - start >= BIN_TRACE_MAGIC_LEN) {
+            parse = parseLines;
+            if (isBinaryTrace(start, end - start)) {
+                parse = parseBinary;
+                start += BIN_TRACE_MAGIC_LEN;
+            }
+        }
+        const char* rest = (parse != NULL) ? parse(start, end, 0) : start;
+        kept = end - rest;
+        if (kept > TRACE_LINE_ROOM) {
+            kept = 0;
+            skipping = 1;
+        }
+        memcpy(carry, rest, kept);
+
+        pthread_mutex_lock(&r.lock);
+        buf->full = 0;
+        pthread_cond_broadcast(&r.changed);
+        pthread_mutex_unlock(&r.lock);
+    }
+
+    pthread_join(reader, NULL);
+    pthread_mutex_destroy(&r.lock);
+    pthread_cond_destroy(&r.changed);
+    free(r.bufs[0].data);
+    free(r.bufs[1].data);
+}
+
+/* TODO - FILL IN THE MISSING CODE
+ * replayTrace - replays the given trace file against the cache 
+ * reads the input trace file line by line
+ * extracts the type of each memory access : L/S/M
+ * YOU MUST TRANSLATE one "L" as a load i.e. 1 memory access
+ * YOU MUST TRANSLATE one "S" as a store i.e. 1 memory access
+ * YOU MUST TRANSLATE one "M" as a load followed by a store i.e. 2 memory accesses 
+ * Regular files are mapped and parsed in place; pipes (and "-", standard
+ * input) and other files that cannot be mapped are read in big chunks
+ * instead, see readTrace
+ * Text traces and binary traces (see BIN_TRACE_MAGIC) are told apart by
+ * their first bytes
+ */
+void replayTrace(char* trace_fn) {                      
+    struct stat st;
+    int fd = (strcmp(trace_fn, "-") == 0) ? STDIN_FILENO :
+        open(trace_fn, O_RDONLY);
 
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        fprintf(stderr, "%s: %s\n", trace_fn, strerror(errno));
+        exit(1);
+    }
+    initHexValues();
 
-/* The cache we are simulating */
-cache_t cache;  
+    // the whole file in one go, no copies
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        char* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            if (isBinaryTrace(map, st.st_size)) {
+                parseBinary(map + BIN_TRACE_MAGIC_LEN, map + st.st_size, 1);
+            } else {
+                parseLines(map, map + st.st_size, 1);
+            }
+            munmap(map, st.st_size);
+            close(fd);
+            return;
+        }
+    }
 
-/* TODO - COMPLETE THIS FUNCTION
- * initCache - 
- * Allocate data structures to hold info regrading the sets and cache lines
- * use struct "cache_line_t" here
- * Initialize valid and tag field with 0s.
- * use S (= 2^s) and E while allocating the data structures here
+    // otherwise chunk by chunk, reading ahead on another thread
+    readTrace(fd, trace_fn);
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+}
+
+/*
+ * convertTrace - rewrites the trace in trace_fn (text or binary) as a
+ * binary trace in out_fn
  */
-void initCache() {
-    // sets B to be equal to number of Blocks
-    B = pow(2, b);
-    // sets S to be equal to number of sets
-    S = pow(2, s);
+void convertTrace(char* trace_fn, char* out_fn) {
+    convert_fp = fopen(out_fn, "wb");
+    if (convert_fp == NULL) {
+        fprintf(stderr, "%s: %s\n", out_fn, strerror(errno));
+        exit(1);
+    }
+    setvbuf(convert_fp, NULL, _IOFBF, TRACE_BUF_SIZE);
+    fwrite(BIN_TRACE_MAGIC, 1, BIN_TRACE_MAGIC_LEN, convert_fp);
+    thread_column = 1;
+    replayTrace(trace_fn);
+    thread_column = 0;
+    if (fclose(convert_fp) != 0) {
+        fprintf(stderr, "%s: %s\n", out_fn, strerror(errno));
+        exit(1);
+    }
+    convert_fp = NULL;
+    if (threads_dropped) {
+        fprintf(stderr, "%s: warning: binary records have no thread, the "
+                "thread column was dropped\n", trace_fn);
+    }
+}
 
-    // allocates memory for S number of sets
-    cache = malloc(sizeof(cache_set_t)*S);
-    // checks if malloc worked properly
-    if (cache == NULL) {
-        fprintf(stderr, "ERROR: could not allocate memory to the heap");
-        exit(0);
+/* Policies to sweep over (-p), in the order given */
+static const policy_t* sweep_policies[NUM_POLICIES];
+
+/*
+ * parsePolicies - looks up the comma separated policy names in list and
+ * stores them in sweep_policies
+ * Returns their number, -1 for unknown or repeated names
+ */
+int parsePolicies(char* list) {
+    char* save = NULL;
+    int n = 0;
+
+    for (char* name = strtok_r(list, ",", &save); name != NULL;
+         name = strtok_r(NULL, ",", &save)) {
+        const policy_t* p = findPolicy(name);
+        for (int i = 0; i < n; i++) {
+            if (sweep_policies[i] == p) {
+                return -1;
+            }
+        }
+        if (p == NULL) {
+            return -1;
+        }
+        sweep_policies[n++] = p;
     }
+    return n;
+}
 
-    // traverses through the sets
-    for (int set = 0; set < S; set++) {
-        // allocates memory for a line in that set
-        cache[set] = malloc(sizeof(cache_line_t) * E);
-        // checks if malloc worked properly
-        if (cache[set] == NULL) {
-            fprintf(stderr, "ERROR: could not allocate memory to the heap");
-            exit(0);
+/*
+ * parseSweepField - parses one field of a sweep configuration: values and
+ * lo-hi ranges separated by commas, e.g. "1,2,4" or "0-6"
+ * Stores up to max values in vals, returns their number, -1 on bad input
+ */
+static int parseSweepField(const char* field, int* vals, int max) {
+    int n = 0;
+
+    while (*field != '\0') {
+        char* end;
+        long lo = strtol(field, &end, 10);
+        long hi = lo;
+        if (end == field) {
+            return -1;
+        }
+        if (*end == '-') {
+            field = end + 1;
+            hi = strtol(field, &end, 10);
+            if (end == field || hi < lo) {
+                return -1;
+            }
+        }
+        for (long v = lo; v <= hi; v++) {
+            if (n == max) {
+                return -1;
+            }
+            vals[n++] = v;
         }
-        // traverses through the lines
-        for (int line = 0; line < E; line++) {
-            // sets valid, tag, and counter to be 0
-            cache[set][line].counter = 0;
-            cache[set][line].tag = 0;
-            cache[set][line].valid = 0;
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            return -1;
         }
+        field = end;
     }
+    return n;
 }
 
+/*
+ * parseSweep - sets up the configurations of a sweep
+ * spec holds terms separated by ';' or blanks; each term is s:E:b where
+ * every field is a list for parseSweepField, and stands for all of their
+ * combinations, e.g. "0-4:1,2,4:5;8:1:6", each with every policy in
+ * sweep_policies
+ * Returns 0 on success, -1 on bad input
+ */
+int parseSweep(char* spec, int npolicies) {
+    const int max = 64;
+    int sv[64], ev[64], bv[64];
+    char* save = NULL;
 
-/* TODO - COMPLETE THIS FUNCTION 
- * freeCache - free each piece of memory you allocated using malloc 
- * inside initCache() function
+    for (char* term = strtok_r(spec, "; \t", &save); term != NULL;
+         term = strtok_r(NULL, "; \t", &save)) {
+        char* fields[3];
+        fields[0] = term;
+        for (int f = 1; f < 3; f++) {
+            fields[f] = strchr(fields[f - 1], ':');
+            if (fields[f] == NULL) {
+                return -1;
+            }
+            *fields[f]++ = '\0';
+        }
+        int ns = parseSweepField(fields[0], sv, max);
+        int ne = parseSweepField(fields[1], ev, max);
+        int nb = parseSweepField(fields[2], bv, max);
+        if (ns <= 0 || ne <= 0 || nb <= 0) {
+            return -1;
+        }
+
+        sweep_cfgs = realloc(sweep_cfgs,
+                             (sweep_n + ns * ne * nb * npolicies) *
+                             sizeof(sweep_cfg_t));
+        if (sweep_cfgs == NULL) {
+            fprintf(stderr, "ERROR: could not allocate memory to the heap\n");
+            exit(1);
+        }
+        for (int i = 0; i < ns; i++) {
+            for (int j = 0; j < ne; j++) {
+                for (int k = 0; k < nb; k++) {
+                    // tags need a spare bit for LINE_VALID
+                    if (sv[i] < 0 || bv[k] < 1 || sv[i] + bv[k] > 63 ||
+                        ev[j] < 1 || ev[j] >= NO_WAY) {
+                        return -1;
+                    }
+                    // one row per policy, skipping tree PLRU where E is
+                    // not a power of 2
+                    for (int p = 0; p < npolicies; p++) {
+                        if (!policyFits(sweep_policies[p], ev[j])) {
+                            continue;
+                        }
+                        sweep_cfg_t* cfg = &sweep_cfgs[sweep_n++];
+                        memset(cfg, 0, sizeof(*cfg));
+                        cfg->cache.s = sv[i];
+                        cfg->cache.E = ev[j];
+                        cfg->cache.b = bv[k];
+                        cfg->cache.policy = sweep_policies[p];
+                    }
+                }
+            }
+        }
+    }
+    return (sweep_n > 0) ? 0 : -1;
+}
+
+/*
+ * runSweep - replays the trace once against every sweep configuration and
+ * prints one row per configuration
  */
-void freeCache() {
-    // for each set
-    for (int j = 0; j < S; j++) {
-        // free up each line in the set
-        free(cache[j]);
+void runSweep(char* trace_fn) {
+    for (int i = 0; i < sweep_n; i++) {
+        cache_t* c = &sweep_cfgs[i].cache;
+        cacheInit(c, c->s, c->E, c->b, c->policy);
+    }
+    replayTrace(trace_fn);
+    sweepFlush();
+
+    printf("%4s %6s %4s %12s %-7s %14s %14s %14s %9s", "s", "E", "b",
+           "size", "policy", "hits", "misses", "evictions", "miss rate");
+    printf(split_straddles ? " %14s\n" : "\n", "straddles");
+    for (int i = 0; i < sweep_n; i++) {
+        sweep_cfg_t* cfg = &sweep_cfgs[i];
+        long long size = ((long long)cfg->cache.E << cfg->cache.s) <<
+            cfg->cache.b;
+        count_t accesses = cfg->hits + cfg->misses;
+        printf("%4d %6d %4d %12lld %-7s %14llu %14llu %14llu %9.4f",
+               cfg->cache.s, cfg->cache.E, cfg->cache.b, size,
+               cfg->cache.policy->name, cfg->hits, cfg->misses,
+               cfg->evictions, accesses ? (double)cfg->misses / accesses : 0);
+        printf(split_straddles ? " %14llu\n" : "\n", cfg->straddles);
+        cacheFree(&cfg->cache);
     }
-    // frees up the cache
-    free(cache);
+    free(sweep_cfgs);
 }
 
-/* TODO - COMPLETE THIS FUNCTION 
- * accessData - Access data at memory address addr.
- *   If it is already in cache, increase hit_cnt
- *   If it is not in cache, bring it in cache, increase miss count.
- *   Also increase evict_cnt if a line is evicted.
- *   you will manipulate data structures allocated in initCache() here
+/*
+ * runStackDistance - replays the trace once in stack distance mode and
+ * prints the misses of fully associative LRU caches of 1, 2, 4, ... lines
+ * up to the size that holds every block
  */
-void accessData(mem_addr_t addr) {
-    // calculates number of t bits
-    int t = 64 - (s + b);
-
-    // grabs the tBits
-    unsigned long long tBits = addr >> (s + b);
-    // grabs the sBits of the addr
-    unsigned long long sBits = ((addr << t) >> (t + b));
-
-    // keeps track of which lines are valid and which ones aren't
-    int valid = 1;
-    // help us keep track of the free line
-    int fLine = -1;
-    // keeps track of if the cache is found
-    int found = 0;
-    // keeps track of the max counter in the cache
-    int maxCounter = -1;
-    // keeps track of if the line is found
-    int lFound = -1;
-    // keeps track of least recently used line
-    int leastRecentlyUsedLine = 0;
-
-    // for each line in the cache
-    for (int i = 0; i < E; i++) {
-        // sets the currentLine
-        cache_line_t currentLine = cache[sBits][i];
-
-        // if valid is true and counter is greater than maxCounter
-        if (currentLine.valid == 1 && currentLine.counter > maxCounter) {
-            // sets new maxCounter
-            maxCounter = currentLine.counter;
-        }
-
-        // if the tag matches and the line is valid
-        if (currentLine.tag == tBits && currentLine.valid == 1 && found == 0) {
-            // sets found to true
-            found = 1;
-            // saves the line
-            lFound = i;
-        }
-
-        // if there is a free line
-        if (currentLine.valid == 0) {
-            // sets valid to false
-            valid = 0;
-            // saves this line
-            fLine = i;
-        }
-    }
-
-    // if address is found
-    if (found == 1) {
-        // update hit count
-        hit_cnt++;
-        // set new counter
-        cache[sBits][lFound].counter = maxCounter + 1;
+void runStackDistance(char* trace_fn) {
+    stack_mode = 1;
+    blockMapResize(&stack_last, BLOCK_MAP_INIT_SIZE);
+    replayTrace(trace_fn);
+
+    printf("accesses:%llu blocks:%d", stack_accesses, stack_blocks);
+    printf(split_straddles ? " straddles:%llu\n" : "\n", straddle_cnt);
+    printf("%12s %14s %14s %14s %14s %9s\n", "lines", "size", "hits",
+           "misses", "evictions", "miss rate");
+    count_t hits = 0;
+    int d = 0;
+    for (long long lines = 1; ; lines *= 2) {
+        for (; d < lines && d < stack_blocks; d++) {
+            hits += stack_hist[d];
+        }
+        count_t misses = stack_accesses - hits;
+        // until it is full the cache fills empty lines without evicting
+        count_t evictions = misses -
+            (lines < stack_blocks ? lines : stack_blocks);
+        printf("%12lld %14lld %14llu %14llu %14llu %9.4f\n", lines,
+               lines << b, hits, misses, evictions,
+               stack_accesses ? (double)misses / stack_accesses : 0);
+        if (lines >= stack_blocks) {
+            break;
+        }
     }
 
-    // if address is not found
-    if (found == 0) {
-        // update miss count
-        miss_cnt++;
-        // if valid is true
-        if (valid == 1) {
-            // update eviction count
-            evict_cnt++;
-            // keeps track of the least recently used
-            int minimum = cache[sBits][0].counter;
-
-            // for each line
-            for (int j = 1; j < E; j++) {
-                // if counter is less than min
-                if (cache[sBits][j].counter < minimum) {
-                    // update minimum
-                    minimum = cache[sBits][j].counter;
-                    // set the least recently used line to that line
-                    leastRecentlyUsedLine = j;
-                }
-            }
+    free(stack_live);
+    free(stack_last.slots);
+    free(stack_hist);
+}
 
-            // updates valid, counter, and tag
-            cache[sBits][leastRecentlyUsedLine].valid = 1;
-            cache[sBits][leastRecentlyUsedLine].counter = maxCounter + 1;
-            cache[sBits][leastRecentlyUsedLine].tag = tBits;
-        // if valid is false
-        } else {
-            // update valid, counter, and tag
-            cache[sBits][fLine].valid = 1;
-            cache[sBits][fLine].counter = maxCounter + 1;
-            cache[sBits][fLine].tag = tBits;
+/*
+ * parseLevels - sets up the hierarchy from spec, one s:E:b[:latency] term
+ * per level separated by ';' or blanks, L1 first; the latency defaults to
+ * 4 cycles for L1 and 3 times that of the level above for the others
+ * Returns 0 on success, -1 on bad input
+ */
+int parseLevels(char* spec) {
+    char* save = NULL;
+
+    for (char* term = strtok_r(spec, "; \t", &save); term != NULL;
+         term = strtok_r(NULL, "; \t", &save)) {
+        int ls, le, lb, lat = 0;
+        int n = sscanf(term, "%d:%d:%d:%d", &ls, &le, &lb, &lat);
+        if (nlevels == MAX_LEVELS || n < 3 || ls < 0 || lb < 1 ||
+            ls + lb > 63 || le < 1 || le >= NO_WAY || lat < 0) {
+            return -1;
+        }
+        if (n == 3) {
+            lat = nlevels ? 3 * levels[nlevels - 1].latency : 4;
+        }
+        // blocks never shrink on the way down (and keep their size when
+        // levels are exclusive)
+        if (nlevels > 0 && (lb < levels[nlevels - 1].cache.b ||
+            (inclusion == INCL_EXCLUSIVE && lb != levels[0].cache.b))) {
+            return -1;
+        }
+        level_t* l = &levels[nlevels++];
+        memset(l, 0, sizeof(*l));
+        if (!policyFits(policy, le)) {
+            return -1;
         }
+        cacheInit(&l->cache, ls, le, lb, policy);
+        l->latency = lat;
     }
+    return (nlevels > 0) ? 0 : -1;
 }
 
-/* TODO - FILL IN THE MISSING CODE
- * replayTrace - replays the given trace file against the cache 
- * reads the input trace file line by line
- * extracts the type of each memory access : L/S/M
- * YOU MUST TRANSLATE one "L" as a load i.e. 1 memory access
- * YOU MUST TRANSLATE one "S" as a store i.e. 1 memory access
- * YOU MUST TRANSLATE one "M" as a load followed by a store i.e. 2 memory accesses 
+/*
+ * runHierarchy - replays the trace against the hierarchy and prints the
+ * statistics of every level and the average memory access time
  */
-void replayTrace(char* trace_fn) {                      
-    char buf[1000];
-    mem_addr_t addr = 0;
-    unsigned int len = 0;
-    FILE* trace_fp = fopen(trace_fn, "r");
+void runHierarchy(char* trace_fn) {
+    replayTrace(trace_fn);
 
-    if (!trace_fp) {
-        fprintf(stderr, "%s: %s\n", trace_fn, strerror(errno));
-        exit(1);
+    count_t accesses = levels[0].hits + levels[0].misses;
+    printf("%-6s %4s %6s %4s %12s %8s %14s %14s %14s %14s %9s\n", "level",
+           "s", "E", "b", "size", "latency", "hits", "misses", "evictions",
+           "invalidated", "miss rate");
+    for (int i = 0; i < nlevels; i++) {
+        level_t* l = &levels[i];
+        long long size = ((long long)l->cache.E << l->cache.s) << l->cache.b;
+        count_t lookups = l->hits + l->misses;
+        printf("L%-5d %4d %6d %4d %12lld %8d %14llu %14llu %14llu %14llu %9.4f\n",
+               i + 1, l->cache.s, l->cache.E, l->cache.b, size, l->latency,
+               l->hits, l->misses, l->evictions, l->invalidations,
+               lookups ? (double)l->misses / lookups : 0);
+        cacheFree(&l->cache);
+    }
+    printf("%-6s %50d %14llu\n", "memory", mem_latency, mem_accesses);
+    printf("AMAT: %.2f cycles\n",
+           accesses ? (double)level_cycles / accesses : 0);
+    if (split_straddles) {
+        printf("straddles:%llu\n", straddle_cnt);
     }
+    if (ntlbs > 0) {
+        printTLB();
+    }
+}
 
-    while (fgets(buf, 1000, trace_fp) != NULL) {
-        if (buf[1] == 'S' || buf[1] == 'L' || buf[1] == 'M') {
-            sscanf(buf+3, "%llx,%u", &addr, &len);
-      
-            if (verbosity)
-                printf("%c %llx,%u ", buf[1], addr, len);
+/*
+ * replayThreads - replays one text trace per core, interleaving them a
+ * line at a time
+ */
+void replayThreads(char** trace_fns, int n) {
+    FILE* fps[MAX_CORES];
+    char* line = NULL;
+    size_t cap = 0;
+    int left = n;
 
-            // if buf[1] is equal to M
-            if (buf[1] == 'M') {
-                // access the Data for addr
-                accessData(addr);
+    initHexValues();
+    for (int i = 0; i < n; i++) {
+        fps[i] = (strcmp(trace_fns[i], "-") == 0) ? stdin :
+            fopen(trace_fns[i], "r");
+        if (fps[i] == NULL) {
+            fprintf(stderr, "%s: %s\n", trace_fns[i], strerror(errno));
+            exit(1);
+        }
+    }
+    while (left > 0) {
+        for (int i = 0; i < n; i++) {
+            ssize_t len = (fps[i] != NULL) ? getline(&line, &cap, fps[i]) : -1;
+            if (len < 0) {
+                if (fps[i] != NULL) {
+                    fclose(fps[i]);
+                    fps[i] = NULL;
+                    left--;
+                }
+                continue;
             }
-            // access the Data for addr
-            accessData(addr);
+            if (isBinaryTrace(line, len)) {
+                fprintf(stderr, "%s: per thread traces must be text\n",
+                        trace_fns[i]);
+                exit(1);
+            }
+            trace_core = i;
+            parseLines(line, line + len, 1);
+        }
+    }
+    free(line);
+}
+
+/*
+ * compareHot - orders block map slots by falling count
+ */
+static int compareHot(const void* x, const void* y) {
+    count_t a = ((const block_slot_t*)x)->time;
+    count_t c = ((const block_slot_t*)y)->time;
+    return (a < c) - (a > c);
+}
+
+/*
+ * runCoherence - replays the traces (one per core, or one with a thread
+ * column) against the cores and prints the statistics of every core, the
+ * coherence misses and the blocks with the most false sharing misses
+ */
+void runCoherence(char** trace_fns, int ntraces) {
+    if (ntraces > 1) {
+        replayThreads(trace_fns, ntraces);
+    } else {
+        thread_column = 1;
+        replayTrace(trace_fns[0]);
+    }
 
-            if (verbosity)
-                printf("\n");
+    core_t total;
+    memset(&total, 0, sizeof(total));
+    printf("%-6s %14s %14s %14s %14s %14s %14s %14s\n", "core", "hits",
+           "misses", "coherence", "evictions", "upgrades", "invalidated",
+           "writebacks");
+    for (int i = 0; i <= ncores; i++) {
+        core_t* c = (i < ncores) ? &cores[i] : &total;
+        if (i < ncores) {
+            printf("%-6d", i);
+            total.hits += c->hits;
+            total.misses += c->misses;
+            total.coherence += c->coherence;
+            total.evictions += c->evictions;
+            total.upgrades += c->upgrades;
+            total.invalidated += c->invalidated;
+            total.writebacks += c->writebacks;
+        } else {
+            printf("%-6s", "total");
         }
+        printf(" %14llu %14llu %14llu %14llu %14llu %14llu %14llu\n",
+               c->hits, c->misses, c->coherence, c->evictions, c->upgrades,
+               c->invalidated, c->writebacks);
     }
+    printf("coherence misses:%llu true sharing:%llu false sharing:%llu\n",
+           total.coherence, true_sharing_cnt, false_sharing_cnt);
 
-    fclose(trace_fp);
+    // the hot blocks end up first once the map is sorted by count
+    block_slot_t* hot = false_sharing.slots;
+    size_t n = 0;
+    for (size_t i = 0; i <= false_sharing.mask; i++) {
+        if (hot[i].block != BLOCK_EMPTY) {
+            hot[n++] = hot[i];
+        }
+    }
+    qsort(hot, n, sizeof(block_slot_t), compareHot);
+    if (n > 0) {
+        printf("false sharing hot lines:\n");
+    }
+    for (size_t i = 0; i < n && i < HOT_LINES; i++) {
+        printf("  %16llx %14llu\n", hot[i].block << b, hot[i].time);
+    }
+    if (split_straddles) {
+        printf("straddles:%llu\n", straddle_cnt);
+    }
+    freeCores();
 }
 
 /*
  * printUsage - Print usage info
  */
 void printUsage(char* argv[]) {                 
-    printf("Usage: %s [-hv] -s <num> -E <num> -b <num> -t <file>\n", argv[0]);
+    printf("Usage: %s [-hvxCO] -s <num> -E <num> -b <num> -t <file> [-p <policy>] [-w <wb|wt>] [-a <wa|nwa>] [-f <prefetcher>] [-T <tlb> [-z <num>] [-u <fraction>]] [-i <isa>] [-j <num>]\n", argv[0]);
+    printf("       %s [-vx] -y <rate> -s <num> -E <num> -b <num> -t <file> [-p <policy>]\n", argv[0]);
+    printf("       %s -t <file> -o <file>\n", argv[0]);
+    printf("       %s -S <configs> -t <file> [-p <policies>] [-i <isa>]\n", argv[0]);
+    printf("       %s [-v] -R -b <num> -t <file>\n", argv[0]);
+    printf("       %s [-v] -L <levels> [-I <policy>] [-m <num>] -t <file>\n", argv[0]);
+    printf("       %s [-vx] -N <num> [-M <protocol>] -s <num> -E <num> -b <num> -t <file>...\n", argv[0]);
     printf("Options:\n");
     printf("  -h         Print this help message.\n");
     printf("  -v         Optional verbose flag.\n");
     printf("  -s <num>   Number of set index bits.\n");
     printf("  -E <num>   Number of lines per set.\n");
     printf("  -b <num>   Number of block offset bits.\n");
-    printf("  -t <file>  Trace file.\n");
+    printf("  -t <file>  Trace file, or - for standard input (pipes work too).\n");
+    printf("  -p <name>  Replacement policy: lru (default), fifo, random, plru,\n");
+    printf("             srrip, brrip or lfu; plru needs E to be a power of 2.\n");
+    printf("             A sweep takes a comma separated list to compare.\n");
+    printf("  -O         Also report Belady's optimal (OPT) replacement.\n");
+    printf("  -x         Split accesses that straddle blocks into one per block.\n");
+    printf("  -C         Classify misses as compulsory, capacity or conflict.\n");
+    printf("  -w <name>  Store hits: wb (write-back) or wt (write-through).\n");
+    printf("  -a <name>  Store misses: wa (write-allocate) or nwa (no-write-allocate).\n");
+    printf("             Either one adds writebacks and bytes moved to the output.\n");
+    printf("  -f <spec>  Prefetcher: kind[:degree[:distance[:latency]]], where kind\n");
+    printf("             is next, stride, region or stream (default 1:1:20).\n");
+    printf("  -i <isa>   Tag compare: scalar, sse4 or avx2 (default: best available).\n");
+    printf("  -j <num>   Simulate with this many threads, each owning a slice of sets.\n");
+    printf("  -o <file>  Convert the trace to the binary format and exit.\n");
+    printf("  -S <list>  Sweep: simulate every s:E:b in the list in one pass.\n");
+    printf("             Fields take values and ranges, e.g. \"0-4:1,2,4:5;8:1:6\".\n");
+    printf("  -R         Stack distances: misses of fully associative LRU\n");
+    printf("             caches of every power of 2 lines in one pass.\n");
+    printf("  -L <list>  Hierarchy: s:E:b[:latency] per level, L1 first, e.g.\n");
+    printf("             \"6:8:6:4;9:8:6:12;13:16:6:40\".\n");
+    printf("  -I <name>  Hierarchy inclusion: nine (default), inclusive or exclusive.\n");
+    printf("  -m <num>   Hierarchy memory latency in cycles (default 100).\n");
+    printf("  -N <num>   Coherence: this many cores with private caches, fed by\n");
+    printf("             one -t trace per core or one trace whose records end\n");
+    printf("             with a thread number (\" L 7ff000398,8 3\").\n");
+    printf("  -M <name>  Coherence protocol: mesi (default) or msi.\n");
+    printf("  -T <list>  TLB: entries:ways per level, first level first, e.g.\n");
+    printf("             \"64:4;1536:12\"; works with a single cache or -L.\n");
+    printf("  -z <num>   TLB page offset bits (default 12).\n");
+    printf("  -u <frac>  TLB: fraction of 2 MiB regions mapped with huge pages.\n");
+    printf("  -y <rate>  Simulate about 1 set in rate (\"32\" or \"1/32\") and\n");
+    printf("             scale the counts; the miss ratio gets a 95%% interval.\n");
     printf("\nExamples:\n");
     printf("  linux>  %s -s 4 -E 1 -b 4 -t traces/yi.trace\n", argv[0]);
     printf("  linux>  %s -v -s 8 -E 2 -b 4 -t traces/yi.trace\n", argv[0]);
+    printf("  linux>  %s -s 10 -E 4 -b 6 -t traces/yi.trace -j 4\n", argv[0]);
+    printf("  linux>  %s -s 6 -E 8 -b 6 -f stream:2:4 -t traces/yi.trace\n", argv[0]);
+    printf("  linux>  %s -t traces/yi.trace -o traces/yi.bin\n", argv[0]);
+    printf("  linux>  %s -S \"1-8:1,2,4,8:4\" -t traces/yi.trace\n", argv[0]);
+    printf("  linux>  %s -S \"6:4,8:6\" -p lru,plru,srrip -t traces/yi.trace\n", argv[0]);
+    printf("  linux>  %s -R -b 6 -t traces/yi.trace\n", argv[0]);
+    printf("  linux>  %s -L \"6:8:6;10:8:6\" -I inclusive -t traces/yi.trace\n", argv[0]);
+    printf("  linux>  %s -N 2 -s 6 -E 8 -b 6 -t t0.trace -t t1.trace\n", argv[0]);
+    printf("  linux>  %s -s 6 -E 8 -b 6 -T \"64:4;1536:12\" -u 0.5 -t traces/yi.trace\n", argv[0]);
+    printf("  linux>  %s -s 14 -E 16 -b 6 -y 1/32 -t traces/yi.trace\n", argv[0]);
     exit(0);
 }
 
@@ -298,11 +3448,12 @@ void printUsage(char* argv[]) {
  * printSummary - Summarize the cache simulation statistics. Student cache simulators
  *                must call this function in order to be properly autograded.
  */
-void printSummary(int hits, int misses, int evictions) {                        
-    printf("hits:%d misses:%d evictions:%d\n", hits, misses, evictions);
+void printSummary(unsigned long long hits, unsigned long long misses,
+                  unsigned long long evictions) {
+    printf("hits:%llu misses:%llu evictions:%llu\n", hits, misses, evictions);
     FILE* output_fp = fopen(".csim_results", "w");
     assert(output_fp);
-    fprintf(output_fp, "%d %d %d\n", hits, misses, evictions);
+    fprintf(output_fp, "%llu %llu %llu\n", hits, misses, evictions);
     fclose(output_fp);
 }
 
@@ -311,50 +3462,471 @@ void printSummary(int hits, int misses, int evictions) {
  */
 int main(int argc, char* argv[]) {                      
     char c;
+    int have_s = 0;
+    char* isa = NULL;
+    char* convert_fn = NULL;
+    char* sweep_spec = NULL;
+    int stack_dist = 0;
+    int threads = 1;
+    char* level_spec = NULL;
+    char* incl = NULL;
+    char* policy_list = NULL;
+    int npolicies = 1;
+    int opt = 0;
+    char* write_hit = NULL;
+    char* write_miss = NULL;
+    char* prefetch_spec = NULL;
+    int core_count = 0;
+    char* protocol = NULL;
+    char* traces[MAX_CORES];
+    int ntraces = 0;
+    char* tlb_spec = NULL;
+    char* sample_spec = NULL;
     
-    // Parse the command line arguments: -h, -v, -s, -E, -b, -t 
-    while ((c = getopt(argc, argv, "s:E:b:t:vh")) != -1) {
+    // Parse the command line arguments: -h, -v, -s, -E, -b, -t, -i, -j, -o,
+    // -S, -R, -L, -I, -m, -p, -O, -w, -a, -x, -C, -f, -N, -M, -T, -z, -u, -y
+    while ((c = getopt(argc, argv, "s:E:b:t:i:j:o:S:RL:I:m:p:Ow:a:xCf:N:M:T:z:u:y:vh")) != -1) {
         switch (c) {
+            case 'a':
+                write_miss = optarg;
+                break;
             case 'b':
                 b = atoi(optarg);
                 break;
+            case 'C':
+                classify_misses = 1;
+                break;
             case 'E':
                 E = atoi(optarg);
                 break;
+            case 'f':
+                prefetch_spec = optarg;
+                break;
             case 'h':
                 printUsage(argv);
                 exit(0);
+            case 'i':
+                isa = optarg;
+                break;
+            case 'I':
+                incl = optarg;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'L':
+                level_spec = optarg;
+                break;
+            case 'm':
+                mem_latency = atoi(optarg);
+                break;
+            case 'M':
+                protocol = optarg;
+                break;
+            case 'N':
+                core_count = atoi(optarg);
+                break;
+            case 'p':
+                policy_list = optarg;
+                break;
+            case 'o':
+                convert_fn = optarg;
+                break;
+            case 'O':
+                opt = 1;
+                break;
+            case 'R':
+                stack_dist = 1;
+                break;
             case 's':
                 s = atoi(optarg);
+                have_s = 1;
+                break;
+            case 'S':
+                sweep_spec = optarg;
+                break;
+            case 'T':
+                tlb_spec = optarg;
                 break;
             case 't':
                 trace_file = optarg;
+                if (ntraces < MAX_CORES) {
+                    traces[ntraces] = optarg;
+                }
+                ntraces++;
+                break;
+            case 'u':
+                huge_fraction = atof(optarg);
                 break;
             case 'v':
                 verbosity = 1;
                 break;
+            case 'w':
+                write_hit = optarg;
+                break;
+            case 'x':
+                split_straddles = 1;
+                break;
+            case 'y':
+                sample_spec = optarg;
+                break;
+            case 'z':
+                page_bits = atoi(optarg);
+                break;
             default:
                 printUsage(argv);
                 exit(1);
         }
     }
 
+    /* Conversion, sweeps, stack distances and hierarchies are separate
+     * modes, and all but -R bring their own geometry */
+    if ((convert_fn != NULL) + (sweep_spec != NULL) + stack_dist +
+        (level_spec != NULL) > 1) {
+        printf("%s: -o, -S, -R and -L exclude each other\n", argv[0]);
+        exit(1);
+    }
+    if ((convert_fn != NULL || sweep_spec != NULL || level_spec != NULL) &&
+        (have_s || E != 0 || b != 0)) {
+        printf("%s: -o, -S and -L do not take -s, -E or -b\n", argv[0]);
+        exit(1);
+    }
+    if (stack_dist && (have_s || E != 0)) {
+        printf("%s: -R only takes -b\n", argv[0]);
+        exit(1);
+    }
+
+    /* Only the cores of coherence mode take a trace each */
+    if (ntraces > 1 && core_count == 0) {
+        printf("%s: Several traces need -N\n", argv[0]);
+        exit(1);
+    }
+    if (core_count != 0 || protocol != NULL) {
+        if (core_count < 1 || core_count > MAX_CORES ||
+            (ntraces > 1 && ntraces != core_count)) {
+            printf("%s: -N must be between 1 and %d, with one trace or one "
+                   "per core\n", argv[0], MAX_CORES);
+            exit(1);
+        }
+        if (protocol != NULL && strcmp(protocol, "msi") == 0) {
+            mesi = 0;
+        } else if (protocol != NULL && strcmp(protocol, "mesi") != 0) {
+            printf("%s: -M must be msi or mesi\n", argv[0]);
+            exit(1);
+        }
+        if (threads > 1 || convert_fn != NULL || sweep_spec != NULL ||
+            stack_dist || level_spec != NULL || write_hit != NULL ||
+            write_miss != NULL || classify_misses || opt ||
+            prefetch_spec != NULL) {
+            printf("%s: -N only combines with -s, -E, -b, -p, -i, -x and "
+                   "-v\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    /* The TLB translates for a single cache or a hierarchy */
+    if (tlb_spec == NULL && (page_bits != 12 || huge_fraction != 0)) {
+        printf("%s: -z and -u need -T\n", argv[0]);
+        exit(1);
+    }
+    if (tlb_spec != NULL) {
+        if (page_bits < 1 || page_bits > 40 || huge_fraction < 0 ||
+            huge_fraction > 1 ||
+            (huge_fraction > 0 && page_bits >= HUGE_PAGE_BITS)) {
+            printf("%s: -z must be between 1 and 40 and -u between 0 and 1, "
+                   "with pages smaller than huge pages\n", argv[0]);
+            exit(1);
+        }
+        if (parseTLB(tlb_spec) != 0) {
+            printf("%s: Bad TLB configuration\n", argv[0]);
+            exit(1);
+        }
+        if (threads > 1 || convert_fn != NULL || sweep_spec != NULL ||
+            stack_dist || core_count != 0) {
+            printf("%s: -T only applies to a single cache or -L\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    /* Sampling stands in for a whole single cache */
+    if (sample_spec != NULL) {
+        sample_rate = atoi(strncmp(sample_spec, "1/", 2) == 0 ?
+                           sample_spec + 2 : sample_spec);
+        if (sample_rate < 1) {
+            printf("%s: -y must be a rate like 32 or 1/32\n", argv[0]);
+            exit(1);
+        }
+        if (threads > 1 || convert_fn != NULL || sweep_spec != NULL ||
+            stack_dist || level_spec != NULL || core_count != 0 ||
+            write_hit != NULL || write_miss != NULL || classify_misses ||
+            opt || prefetch_spec != NULL || tlb_spec != NULL) {
+            printf("%s: -y only combines with -s, -E, -b, -p, -i, -x and "
+                   "-v\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    /* Write policies of a single cache */
+    if (write_hit != NULL || write_miss != NULL) {
+        model_writes = 1;
+        if (write_hit != NULL && strcmp(write_hit, "wt") == 0) {
+            write_through = 1;
+        } else if (write_hit != NULL && strcmp(write_hit, "wb") != 0) {
+            printf("%s: -w must be wb or wt\n", argv[0]);
+            exit(1);
+        }
+        if (write_miss != NULL && strcmp(write_miss, "nwa") == 0) {
+            write_allocate = 0;
+        } else if (write_miss != NULL && strcmp(write_miss, "wa") != 0) {
+            printf("%s: -a must be wa or nwa\n", argv[0]);
+            exit(1);
+        }
+        if (threads > 1 || convert_fn != NULL || sweep_spec != NULL ||
+            stack_dist || level_spec != NULL) {
+            printf("%s: -w and -a only apply to a single cache\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    /* Classification shadows a single cache */
+    if (classify_misses && (threads > 1 || convert_fn != NULL ||
+                            sweep_spec != NULL || stack_dist ||
+                            level_spec != NULL)) {
+        printf("%s: -C only applies to a single cache\n", argv[0]);
+        exit(1);
+    }
+
+    /* Prefetching into a single cache */
+    if (prefetch_spec != NULL) {
+        if (parsePrefetcher(prefetch_spec) != 0) {
+            printf("%s: Bad prefetcher %s\n", argv[0], prefetch_spec);
+            exit(1);
+        }
+        if (threads > 1 || convert_fn != NULL || sweep_spec != NULL ||
+            stack_dist || level_spec != NULL) {
+            printf("%s: -f only applies to a single cache\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    /* OPT runs next to a single cache */
+    if (opt && (threads > 1 || convert_fn != NULL || sweep_spec != NULL ||
+                stack_dist || level_spec != NULL)) {
+        printf("%s: -O only applies to a single cache\n", argv[0]);
+        exit(1);
+    }
+
+    /* Replacement policies; only a sweep compares several */
+    sweep_policies[0] = policy;
+    if (policy_list != NULL) {
+        npolicies = parsePolicies(policy_list);
+        if (npolicies < 1 || (npolicies > 1 && sweep_spec == NULL)) {
+            printf("%s: Bad replacement policy list\n", argv[0]);
+            exit(1);
+        }
+        policy = sweep_policies[0];
+    }
+    if (stack_dist && policy != &policies[0]) {
+        printf("%s: -R only models LRU\n", argv[0]);
+        exit(1);
+    }
+
+    /* Threads split the sets of a single cache */
+    if (threads < 1) {
+        printf("%s: -j must be at least 1\n", argv[0]);
+        exit(1);
+    }
+    if (threads > 1 && (convert_fn != NULL || sweep_spec != NULL ||
+                        stack_dist || level_spec != NULL)) {
+        printf("%s: -j only applies to a single cache\n", argv[0]);
+        exit(1);
+    }
+
+    /* Conversion only needs the trace */
+    if (convert_fn != NULL) {
+        if (trace_file == NULL) {
+            printf("%s: Missing required command line argument\n", argv[0]);
+            printUsage(argv);
+            exit(1);
+        }
+        convertTrace(trace_file, convert_fn);
+        return 0;
+    }
+
+    /* A sweep brings its own configurations */
+    if (sweep_spec != NULL) {
+        if (trace_file == NULL) {
+            printf("%s: Missing required command line argument\n", argv[0]);
+            printUsage(argv);
+            exit(1);
+        }
+        if (parseSweep(sweep_spec, npolicies) != 0) {
+            printf("%s: Bad sweep configuration\n", argv[0]);
+            exit(1);
+        }
+        if (chooseScanner(isa) != 0) {
+            printf("%s: Tag scanner %s is not supported\n", argv[0], isa);
+            exit(1);
+        }
+        // per access traces only make sense for a single cache
+        verbosity = 0;
+        runSweep(trace_file);
+        return 0;
+    }
+
+    /* Stack distances only depend on the block size */
+    if (stack_dist) {
+        if (b == 0 || trace_file == NULL) {
+            printf("%s: Missing required command line argument\n", argv[0]);
+            printUsage(argv);
+            exit(1);
+        }
+        runStackDistance(trace_file);
+        return 0;
+    }
+
+    /* A hierarchy brings its own levels */
+    if (level_spec != NULL) {
+        if (trace_file == NULL) {
+            printf("%s: Missing required command line argument\n", argv[0]);
+            printUsage(argv);
+            exit(1);
+        }
+        if (incl == NULL || strcmp(incl, "nine") == 0) {
+            inclusion = INCL_NINE;
+        } else if (strcmp(incl, "inclusive") == 0) {
+            inclusion = INCL_INCLUSIVE;
+        } else if (strcmp(incl, "exclusive") == 0) {
+            inclusion = INCL_EXCLUSIVE;
+        } else {
+            printf("%s: Unknown inclusion policy %s\n", argv[0], incl);
+            exit(1);
+        }
+        if (chooseScanner(isa) != 0) {
+            printf("%s: Tag scanner %s is not supported\n", argv[0], isa);
+            exit(1);
+        }
+        if (parseLevels(level_spec) != 0) {
+            printf("%s: Bad cache hierarchy\n", argv[0]);
+            exit(1);
+        }
+        runHierarchy(trace_file);
+        return 0;
+    }
+
     /* Make sure that all required command line args were specified */
-    if (s == 0 || E == 0 || b == 0 || trace_file == NULL) {
+    if (!have_s || E == 0 || b == 0 || trace_file == NULL) {
         printf("%s: Missing required command line argument\n", argv[0]);
         printUsage(argv);
         exit(1);
     }
 
+    /* Ways are numbered with way_t, which reserves NO_WAY */
+    if (E < 1 || E >= NO_WAY) {
+        printf("%s: -E must be between 1 and %d\n", argv[0], NO_WAY - 1);
+        exit(1);
+    }
+    if (!policyFits(policy, E)) {
+        printf("%s: -p %s needs -E to be a power of 2\n", argv[0],
+               policy->name);
+        exit(1);
+    }
+
+    /* Pick how tags are compared */
+    if (chooseScanner(isa) != 0) {
+        printf("%s: Tag scanner %s is not supported\n", argv[0], isa);
+        exit(1);
+    }
+
+    /* Coherence mode brings one cache per core */
+    if (core_count > 0) {
+        initCores(core_count);
+        runCoherence(traces, ntraces);
+        return 0;
+    }
+
+    /* Sampling keeps only some of the sets */
+    if (sample_rate > 0) {
+        initSampling();
+        replayTrace(trace_file);
+        finishSampling();
+        printSummary(hit_cnt, miss_cnt, evict_cnt);
+        printf("sampled sets:%zu of %d miss ratio:%.4f +- %.4f (95%%)\n",
+               sample_sets, S, sample_ratio, sample_margin);
+        if (split_straddles) {
+            printf("straddles:%llu\n", straddle_cnt);
+        }
+        return 0;
+    }
+
     /* Initialize cache */
     initCache();
+    if (classify_misses) {
+        // the line count must fit the shadow cache's links
+        if ((unsigned long long)S * E >= UINT_MAX) {
+            printf("%s: -C needs a smaller cache\n", argv[0]);
+            exit(1);
+        }
+        initShadow(S * E);
+    }
+    if (prefetch_kind) {
+        initPrefetcher();
+    }
 
-    replayTrace(trace_file);
+    if (opt) {
+        opt_fd = openTemp();
+    }
+
+    if (threads > 1) {
+        startWorkers(threads);
+        replayTrace(trace_file);
+        stopWorkers();
+    } else {
+        replayTrace(trace_file);
+    }
 
     /* Free allocated memory */
+    if (prefetch_kind) {
+        finishPrefetcher();
+    }
     freeCache();
 
     /* Output the hit and miss statistics for the autograder */
     printSummary(hit_cnt, miss_cnt, evict_cnt);
+
+    /* Where the misses came from */
+    if (classify_misses) {
+        printf("compulsory:%llu capacity:%llu conflict:%llu\n",
+               compulsory_cnt, capacity_cnt, conflict_cnt);
+        freeShadow();
+    }
+
+    /* Accesses split across blocks */
+    if (split_straddles) {
+        printf("straddles:%llu\n", straddle_cnt);
+    }
+
+    /* The traffic to the next level */
+    if (model_writes) {
+        printf("writebacks:%llu bytes read:%llu bytes written:%llu\n",
+               writeback_cnt, bytes_read, bytes_written);
+    }
+
+    /* What the prefetcher did */
+    if (prefetch_kind) {
+        printf("prefetches:%llu useful:%llu late:%llu useless:%llu "
+               "evictions:%llu misses without prefetch:%llu\n", pf_issued,
+               pf_useful, pf_late, pf_useless, pf_evictions, pf_base_misses);
+    }
+
+    /* The translations */
+    if (ntlbs > 0) {
+        printTLB();
+    }
+
+    /* And what the optimal policy would have done */
+    if (opt) {
+        runOpt();
+    }
     return 0;
 }